@@ -28,14 +28,20 @@
 
 
 #define DEFAULT_SERVER_PORT  0
+#define DEFAULT_DRAIN_BUDGET 64
 #define DEFAULT_OSC_PREFIX   "/monome"
 #define DEFAULT_APP_PORT     8000
 #define DEFAULT_APP_HOST     "127.0.0.1"
 #define DEFAULT_ROTATION     MONOME_ROTATE_0
+#define DEFAULT_BUNDLE       cfg_false
+#define DEFAULT_BUNDLE_WINDOW 0
+#define DEFAULT_LED_RATE     0
+#define DEFAULT_SETTLE_TIME  200
 
 
 static cfg_opt_t server_opts[] = {
 	CFG_INT("port",       DEFAULT_SERVER_PORT, CFGF_NONE),
+	CFG_INT("drain_budget", DEFAULT_DRAIN_BUDGET, CFGF_NONE),
 	CFG_END()
 };
 
@@ -43,11 +49,14 @@ static cfg_opt_t app_opts[] = {
 	CFG_STR("osc_prefix", DEFAULT_OSC_PREFIX,  CFGF_NONE),
 	CFG_STR("host",       DEFAULT_APP_HOST,    CFGF_NONE),
 	CFG_INT("port",       DEFAULT_APP_PORT,    CFGF_NONE),
+	CFG_BOOL("bundle",    DEFAULT_BUNDLE,      CFGF_NONE),
+	CFG_INT("bundle_window", DEFAULT_BUNDLE_WINDOW, CFGF_NONE),
 	CFG_END()
 };
 
 static cfg_opt_t dev_opts[] = {
 	CFG_INT("rotation",   DEFAULT_ROTATION,    CFGF_NONE),
+	CFG_INT("led_rate",   DEFAULT_LED_RATE,    CFGF_NONE),
 	CFG_END()
 };
 
@@ -58,6 +67,34 @@ static cfg_opt_t opts[] = {
 	CFG_END()
 };
 
+/* detector.conf, which is only ever read. serial patterns are matched
+   against udev's ID_SERIAL, "<manufacturer>_<product>_<serial>", e.g.
+
+     settle_time = 250
+
+     match {
+         vendor_id = "0403"
+         serial = "*_m*"
+     }
+
+     ignore {
+         model_id = "6015"
+     } */
+
+static cfg_opt_t match_opts[] = {
+	CFG_STR("vendor_id",  NULL,                CFGF_NONE),
+	CFG_STR("model_id",   NULL,                CFGF_NONE),
+	CFG_STR("serial",     NULL,                CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t detector_opts[] = {
+	CFG_INT("settle_time", DEFAULT_SETTLE_TIME, CFGF_NONE),
+	CFG_SEC("match", match_opts, CFGF_MULTI),
+	CFG_SEC("ignore", match_opts, CFGF_MULTI),
+	CFG_END()
+};
+
 
 static void prepend_slash_if_necessary(char **dest, char *prefix) {
 	if( *prefix != '/' )
@@ -97,14 +134,27 @@ int sosc_config_read(const char *serial, sosc_config_t *config) {
 
 	sec = cfg_getsec(cfg, "server");
 	sosc_port_itos(config->server.port, cfg_getint(sec, "port"));
+	config->server.drain_budget = cfg_getint(sec, "drain_budget");
+
+	if( config->server.drain_budget < 1 )
+		config->server.drain_budget = 1;
 
 	sec = cfg_getsec(cfg, "application");
 	prepend_slash_if_necessary(&config->app.osc_prefix, cfg_getstr(sec, "osc_prefix"));
 	config->app.host = s_strdup(cfg_getstr(sec, "host"));
 	sosc_port_itos(config->app.port, cfg_getint(sec, "port"));
+	config->app.bundle.enabled = cfg_getbool(sec, "bundle");
+	config->app.bundle.window = cfg_getint(sec, "bundle_window");
+
+	if( config->app.bundle.window < 0 )
+		config->app.bundle.window = 0;
 
 	sec = cfg_getsec(cfg, "device");
 	config->dev.rotation = (cfg_getint(sec, "rotation") / 90) % 4;
+	config->dev.led_rate = cfg_getint(sec, "led_rate");
+
+	if( config->dev.led_rate < 0 )
+		config->dev.led_rate = 0;
 
 	cfg_free(cfg);
 
@@ -132,15 +182,19 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	sec = cfg_getsec(cfg, "server");
 	cfg_setint(sec, "port", lo_server_get_port(state->server));
+	cfg_setint(sec, "drain_budget", state->config.server.drain_budget);
 
 	sec = cfg_getsec(cfg, "application");
 	cfg_setstr(sec, "osc_prefix", state->config.app.osc_prefix);
 	cfg_setstr(sec, "host", lo_address_get_hostname(state->outgoing));
 	p = lo_address_get_port(state->outgoing);
 	cfg_setint(sec, "port", strtol(p , NULL, 10));
+	cfg_setbool(sec, "bundle", state->config.app.bundle.enabled);
+	cfg_setint(sec, "bundle_window", state->config.app.bundle.window);
 
 	sec = cfg_getsec(cfg, "device");
 	cfg_setint(sec, "rotation", monome_get_rotation(state->monome) * 90);
+	cfg_setint(sec, "led_rate", state->config.dev.led_rate);
 
 	cfg_print(cfg, f);
 	fclose(f);
@@ -149,3 +203,80 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	return 0;
 }
+
+static char *strdup_or_null(const char *s) {
+	return (s) ? s_strdup(s) : NULL;
+}
+
+static sosc_device_match_t *read_matches(cfg_t *cfg, const char *name,
+                                         int *count) {
+	sosc_device_match_t *matches;
+	cfg_t *sec;
+	int i;
+
+	if( !(*count = cfg_size(cfg, name)) )
+		return NULL;
+
+	if( !(matches = s_calloc(*count, sizeof(*matches))) ) {
+		*count = 0;
+		return NULL;
+	}
+
+	for( i = 0; i < *count; i++ ) {
+		sec = cfg_getnsec(cfg, name, i);
+
+		matches[i].vendor_id = strdup_or_null(cfg_getstr(sec, "vendor_id"));
+		matches[i].model_id  = strdup_or_null(cfg_getstr(sec, "model_id"));
+		matches[i].serial    = strdup_or_null(cfg_getstr(sec, "serial"));
+	}
+
+	return matches;
+}
+
+int sosc_detector_config_read(sosc_detector_config_t *config) {
+	char *path, *cdir;
+	cfg_t *cfg;
+
+	memset(config, 0, sizeof(*config));
+
+	cdir = sosc_get_config_directory();
+	path = s_asprintf("%s/detector.conf", cdir);
+	s_free(cdir);
+
+	cfg = cfg_init(detector_opts, CFGF_NOCASE);
+
+	switch( cfg_parse(cfg, path) ) {
+	case CFG_PARSE_ERROR:
+		fprintf(stderr, "serialosc: parse error in %s\n", path);
+		break;
+	}
+
+	s_free(path);
+
+	config->settle_time = cfg_getint(cfg, "settle_time");
+	config->match  = read_matches(cfg, "match", &config->nmatch);
+	config->ignore = read_matches(cfg, "ignore", &config->nignore);
+
+	cfg_free(cfg);
+
+	return 0;
+}
+
+static void free_matches(sosc_device_match_t *matches, int count) {
+	int i;
+
+	for( i = 0; i < count; i++ ) {
+		s_free(matches[i].vendor_id);
+		s_free(matches[i].model_id);
+		s_free(matches[i].serial);
+	}
+
+	s_free(matches);
+}
+
+void sosc_detector_config_free(sosc_detector_config_t *config) {
+	free_matches(config->match, config->nmatch);
+	free_matches(config->ignore, config->nignore);
+
+	memset(config, 0, sizeof(*config));
+}
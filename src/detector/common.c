@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <string.h>
+#include <fnmatch.h>
+
+#include "serialosc.h"
+#include "detector.h"
+
+/* shared by the POSIX detectors, to decide which serial devices are
+   worth handing to the supervisor at all, and when. */
+
+/**
+ * device filtering
+ */
+
+static int field_matches(const char *pattern, const char *value)
+{
+	if (!pattern)
+		return 1;
+
+	/* a pattern can't match a property the device doesn't have */
+	if (!value)
+		return 0;
+
+	return !fnmatch(pattern, value, 0);
+}
+
+static int matches(const sosc_device_match_t *m, const char *vendor_id,
+                   const char *model_id, const char *serial)
+{
+	return field_matches(m->vendor_id, vendor_id)
+		&& field_matches(m->model_id, model_id)
+		&& field_matches(m->serial, serial);
+}
+
+/* nonzero if the device should be reported. with no match sections in
+   the config, every USB serial device is, as before. */
+int sosc_device_match(const sosc_detector_config_t *config,
+                      const char *vendor_id, const char *model_id,
+                      const char *serial)
+{
+	int i;
+
+	for (i = 0; i < config->nignore; i++)
+		if (matches(&config->ignore[i], vendor_id, model_id, serial))
+			return 0;
+
+	if (!config->nmatch)
+		return 1;
+
+	for (i = 0; i < config->nmatch; i++)
+		if (matches(&config->match[i], vendor_id, model_id, serial))
+			return 1;
+
+	return 0;
+}
+
+/**
+ * hotplug debouncing
+ *
+ * a hub reset or a bad cable turns into a burst of adds and removes for
+ * the same devnode, and every add we pass on costs the supervisor a new
+ * server. so we hold on to each devnode's events until it's been quiet
+ * for the settle time, and only then report it, if it's still there.
+ *
+ * a devnode which settles as present is always reported, even if it was
+ * reported before the burst: once it's gone away, the server which had
+ * it open has too.
+ */
+
+void sosc_hotplug_init(sosc_hotplug_t *h, int settle_ms,
+                       sosc_hotplug_connect_t connect)
+{
+	h->settle = (settle_ms > 0) ? settle_ms * 1000ULL : 0;
+	h->connect = connect;
+	h->pending = NULL;
+}
+
+static void free_node(sosc_hotplug_node_t *n)
+{
+	s_free(n->devnode);
+	s_free(n);
+}
+
+void sosc_hotplug_fini(sosc_hotplug_t *h)
+{
+	sosc_hotplug_node_t *n, *next;
+
+	for (n = h->pending; n; n = next) {
+		next = n->next;
+		free_node(n);
+	}
+
+	h->pending = NULL;
+}
+
+void sosc_hotplug_event(sosc_hotplug_t *h, const char *devnode, int present)
+{
+	sosc_hotplug_node_t *n;
+
+	if (!h->settle) {
+		if (present)
+			h->connect(devnode);
+		return;
+	}
+
+	for (n = h->pending; n; n = n->next)
+		if (!strcmp(n->devnode, devnode))
+			break;
+
+	if (!n) {
+		/* nothing to take back, and nothing to report */
+		if (!present)
+			return;
+
+		if (!(n = s_calloc(1, sizeof(*n))))
+			return;
+
+		if (!(n->devnode = s_strdup(devnode))) {
+			s_free(n);
+			return;
+		}
+
+		n->next = h->pending;
+		h->pending = n;
+	}
+
+	n->present = present;
+	n->deadline = sosc_monotonic_us() + h->settle;
+}
+
+/* the poll() timeout until the next devnode settles, or -1 */
+int sosc_hotplug_timeout(const sosc_hotplug_t *h)
+{
+	sosc_hotplug_node_t *n;
+	uint64_t deadline = 0, now;
+
+	for (n = h->pending; n; n = n->next)
+		if (!deadline || n->deadline < deadline)
+			deadline = n->deadline;
+
+	if (!deadline)
+		return -1;
+
+	now = sosc_monotonic_us();
+
+	if (now >= deadline)
+		return 0;
+
+	/* round up, otherwise we'd spin until the deadline */
+	return (deadline - now + 999) / 1000;
+}
+
+void sosc_hotplug_service(sosc_hotplug_t *h)
+{
+	sosc_hotplug_node_t *n, **prev;
+	uint64_t now = sosc_monotonic_us();
+
+	for (prev = &h->pending; (n = *prev);) {
+		if (n->deadline > now) {
+			prev = &n->next;
+			continue;
+		}
+
+		*prev = n->next;
+
+		if (n->present)
+			h->connect(n->devnode);
+
+		free_node(n);
+	}
+}
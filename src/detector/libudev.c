@@ -29,11 +29,15 @@
 
 #include "serialosc.h"
 #include "ipc.h"
+#include "detector.h"
 
 
 typedef struct {
 	struct udev *u;
 	struct udev_monitor *um;
+
+	sosc_detector_config_t config;
+	sosc_hotplug_t hotplug;
 } detector_state_t;
 
 
@@ -47,15 +51,24 @@ static void send_connect(const char *devnode)
 	sosc_ipc_msg_write(STDOUT_FILENO, &msg);
 }
 
+static int device_wanted(detector_state_t *state, struct udev_device *ud)
+{
+	return sosc_device_match(&state->config,
+		udev_device_get_property_value(ud, "ID_VENDOR_ID"),
+		udev_device_get_property_value(ud, "ID_MODEL_ID"),
+		udev_device_get_property_value(ud, "ID_SERIAL"));
+}
+
 static monome_t *monitor_attach(detector_state_t *state) {
 	struct udev_device *ud;
 	struct pollfd fds[1];
+	const char *devnode;
 
 	fds[0].fd = udev_monitor_get_fd(state->um);
 	fds[0].events = POLLIN;
 
 	do {
-		if( poll(fds, 1, -1) < 0 )
+		if( poll(fds, 1, sosc_hotplug_timeout(&state->hotplug)) < 0 )
 			switch( errno ) {
 			case EINVAL:
 				perror("error in poll()");
@@ -66,14 +79,28 @@ static monome_t *monitor_attach(detector_state_t *state) {
 				continue;
 			}
 
-		ud = udev_monitor_receive_device(state->um);
+		if( (fds[0].revents & POLLIN)
+		    && (ud = udev_monitor_receive_device(state->um)) ) {
+			devnode = udev_device_get_devnode(ud);
 
-		/* check if this was an add event.
-		   "add"[0] == 'a' */
-		if( *(udev_device_get_action(ud)) == 'a' )
-			send_connect(udev_device_get_devnode(ud));
+			/* "add"[0] == 'a', "remove"[0] == 'r'. "change" doesn't
+			   tell us anything about whether the device is there. */
+			if( devnode )
+				switch( *(udev_device_get_action(ud)) ) {
+				case 'a':
+					if( device_wanted(state, ud) )
+						sosc_hotplug_event(&state->hotplug, devnode, 1);
+					break;
 
-		udev_device_unref(ud);
+				case 'r':
+					sosc_hotplug_event(&state->hotplug, devnode, 0);
+					break;
+				}
+
+			udev_device_unref(ud);
+		}
+
+		sosc_hotplug_service(&state->hotplug);
 	} while( 1 );
 }
 
@@ -96,7 +123,8 @@ int scan_connected_devices(detector_state_t *state) {
 		ud = udev_device_new_from_syspath(
 			state->u, udev_list_entry_get_name(cursor));
 
-		if( (devnode = udev_device_get_devnode(ud)) )
+		if( (devnode = udev_device_get_devnode(ud))
+		    && device_wanted(state, ud) )
 			send_connect(devnode);
 
 		udev_device_unref(ud);
@@ -110,6 +138,8 @@ int sosc_detector_run(const char *exec_path) {
 	detector_state_t state;
 
 	state.u = udev_new();
+	sosc_detector_config_read(&state.config);
+	sosc_hotplug_init(&state.hotplug, state.config.settle_time, send_connect);
 
 	if( scan_connected_devices(&state) )
 		return 1;
@@ -125,6 +155,8 @@ int sosc_detector_run(const char *exec_path) {
 
 	udev_monitor_unref(state.um);
 	udev_unref(state.u);
+	sosc_hotplug_fini(&state.hotplug);
+	sosc_detector_config_free(&state.config);
 
 	return 0;
 }
@@ -0,0 +1,304 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "serialosc.h"
+#include "ipc.h"
+#include "detector.h"
+
+#define SYS_CLASS_TTY "/sys/class/tty"
+
+/* for systems without udev. the kernel lists every tty under
+   /sys/class/tty as soon as it's registered, and devtmpfs creates the
+   node in /dev at the same time, so we watch the latter for new nodes
+   and then scan the former, so that nothing created in between slips
+   past both. */
+
+typedef struct scanned_node {
+	char *name;
+	struct scanned_node *next;
+} scanned_node_t;
+
+typedef struct {
+	int inotify_fd;
+
+	/* ttys reported by the startup scan and not yet removed. a node
+	   created while we were scanning shows up both there and in the
+	   queued inotify events, and should only be reported once. */
+	scanned_node_t *scanned;
+
+	sosc_detector_config_t config;
+	sosc_hotplug_t hotplug;
+} detector_state_t;
+
+
+static void send_connect(const char *devnode)
+{
+	sosc_ipc_msg_t msg = {
+		.type = SOSC_DEVICE_CONNECTION,
+		.connection = {.devnode = (char *) devnode}
+	};
+
+	sosc_ipc_msg_write(STDOUT_FILENO, &msg);
+}
+
+/* reads the first line of a sysfs attribute, less the newline */
+static int read_attr(const char *dir, const char *attr, char *buf, size_t len) {
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+	if( !(f = fopen(path, "r")) )
+		return 0;
+
+	if( !fgets(buf, len, f) ) {
+		fclose(f);
+		return 0;
+	}
+
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 1;
+}
+
+/* a tty's device link points at a USB interface (cdc-acm) or at a
+   usb-serial port below one. the USB device itself is the nearest
+   ancestor with an idVendor, and ttys which have none aren't USB. */
+static int find_usb_device(const char *tty, char usbdev[PATH_MAX]) {
+	char link[PATH_MAX], id[8], *slash;
+
+	snprintf(link, sizeof(link), SYS_CLASS_TTY "/%s/device", tty);
+
+	if( !realpath(link, usbdev) )
+		return 0;
+
+	while( (slash = strrchr(usbdev, '/')) && slash != usbdev ) {
+		if( read_attr(usbdev, "idVendor", id, sizeof(id)) )
+			return 1;
+
+		*slash = '\0';
+	}
+
+	return 0;
+}
+
+/* udev's ID_SERIAL is "<manufacturer>_<product>_<serial>" with spaces
+   turned into underscores, so build the same thing for the config's
+   serial patterns to match against. */
+static void id_serial(const char *usbdev, char *buf, size_t len) {
+	char part[128], *c;
+	size_t used = 0;
+
+	if( read_attr(usbdev, "manufacturer", part, sizeof(part))
+	    || read_attr(usbdev, "idVendor", part, sizeof(part)) )
+		used += snprintf(buf + used, len - used, "%s", part);
+
+	if( used < len && (read_attr(usbdev, "product", part, sizeof(part))
+	    || read_attr(usbdev, "idProduct", part, sizeof(part))) )
+		used += snprintf(buf + used, len - used, "_%s", part);
+
+	if( used < len && read_attr(usbdev, "serial", part, sizeof(part)) )
+		snprintf(buf + used, len - used, "_%s", part);
+
+	for( c = buf; *c; c++ )
+		if( *c == ' ' )
+			*c = '_';
+}
+
+static int device_wanted(detector_state_t *state, const char *usbdev) {
+	char vendor[8] = "", model[8] = "", serial[384] = "";
+
+	read_attr(usbdev, "idVendor", vendor, sizeof(vendor));
+	read_attr(usbdev, "idProduct", model, sizeof(model));
+	id_serial(usbdev, serial, sizeof(serial));
+
+	return sosc_device_match(&state->config, vendor, model, serial);
+}
+
+static void check_tty(detector_state_t *state, const char *tty,
+                      void (*found)(detector_state_t *, const char *)) {
+	char usbdev[PATH_MAX], devnode[PATH_MAX];
+
+	if( !find_usb_device(tty, usbdev) || !device_wanted(state, usbdev) )
+		return;
+
+	snprintf(devnode, sizeof(devnode), "/dev/%s", tty);
+	found(state, devnode);
+}
+
+static void connect_now(detector_state_t *state, const char *devnode) {
+	scanned_node_t *n;
+
+	send_connect(devnode);
+
+	if( !(n = s_malloc(sizeof(*n))) )
+		return;
+
+	/* skip the "/dev/" */
+	if( !(n->name = s_strdup(devnode + 5)) ) {
+		s_free(n);
+		return;
+	}
+
+	n->next = state->scanned;
+	state->scanned = n;
+}
+
+/* nonzero if the node was reported by the scan, which it no longer
+   needs to be remembered for once it's been seen again or removed. */
+static int forget_scanned(detector_state_t *state, const char *name) {
+	scanned_node_t *n, **prev;
+
+	for( prev = &state->scanned; (n = *prev); prev = &n->next )
+		if( !strcmp(n->name, name) ) {
+			*prev = n->next;
+			s_free(n->name);
+			s_free(n);
+			return 1;
+		}
+
+	return 0;
+}
+
+static void free_scanned(detector_state_t *state) {
+	while( state->scanned )
+		forget_scanned(state, state->scanned->name);
+}
+
+static void connect_settled(detector_state_t *state, const char *devnode) {
+	sosc_hotplug_event(&state->hotplug, devnode, 1);
+}
+
+static void node_removed(detector_state_t *state, const char *name) {
+	char devnode[PATH_MAX];
+
+	/* sysfs has already forgotten the device by now, but only nodes
+	   we're holding on to matter anyway. */
+	snprintf(devnode, sizeof(devnode), "/dev/%s", name);
+	sosc_hotplug_event(&state->hotplug, devnode, 0);
+}
+
+static int monitor_attach(detector_state_t *state) {
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+
+	struct inotify_event *ev;
+	struct pollfd fds[1];
+	ssize_t len;
+	char *p;
+
+	fds[0].fd = state->inotify_fd;
+	fds[0].events = POLLIN;
+
+	do {
+		if( poll(fds, 1, sosc_hotplug_timeout(&state->hotplug)) < 0 ) {
+			if( errno == EINTR || errno == EAGAIN )
+				continue;
+
+			perror("error in poll()");
+			return 1;
+		}
+
+		len = 0;
+
+		if( (fds[0].revents & POLLIN)
+		    && (len = read(state->inotify_fd, u.buf, sizeof(u.buf))) < 0 ) {
+			if( errno == EINTR || errno == EAGAIN )
+				continue;
+
+			perror("error reading inotify events");
+			return 1;
+		}
+
+		for( p = u.buf; p < u.buf + len; p += sizeof(*ev) + ev->len ) {
+			ev = (struct inotify_event *) p;
+
+			if( ev->mask & IN_Q_OVERFLOW )
+				fprintf(stderr, "serialosc: missed some /dev events\n");
+
+			if( !ev->len )
+				continue;
+
+			/* nodes for anything other than ttys won't have a
+			   /sys/class/tty entry, so check_tty() skips them. */
+			if( ev->mask & IN_CREATE ) {
+				if( !forget_scanned(state, ev->name) )
+					check_tty(state, ev->name, connect_settled);
+			} else if( ev->mask & IN_DELETE ) {
+				forget_scanned(state, ev->name);
+				node_removed(state, ev->name);
+			}
+		}
+
+		sosc_hotplug_service(&state->hotplug);
+	} while( 1 );
+}
+
+static int scan_connected_devices(detector_state_t *state) {
+	struct dirent *ent;
+	DIR *dir;
+
+	if( !(dir = opendir(SYS_CLASS_TTY)) )
+		return 1;
+
+	while( (ent = readdir(dir)) )
+		if( ent->d_name[0] != '.' )
+			check_tty(state, ent->d_name, connect_now);
+
+	closedir(dir);
+	return 0;
+}
+
+int sosc_detector_run(const char *exec_path) {
+	detector_state_t state;
+
+	state.scanned = NULL;
+	sosc_detector_config_read(&state.config);
+	sosc_hotplug_init(&state.hotplug, state.config.settle_time, send_connect);
+
+	if( (state.inotify_fd = inotify_init()) < 0 )
+		return 2;
+
+	if( inotify_add_watch(state.inotify_fd, "/dev", IN_CREATE | IN_DELETE) < 0 )
+		return 2;
+
+	if( scan_connected_devices(&state) )
+		return 1;
+
+	if( monitor_attach(&state) )
+		return 3;
+
+	close(state.inotify_fd);
+	free_scanned(&state);
+	sosc_hotplug_fini(&state.hotplug);
+	sosc_detector_config_free(&state.config);
+
+	return 0;
+}
@@ -53,7 +53,7 @@ static struct detector_state state = {
 
 void send_connect(char *port)
 {
-	uint8_t buf[64];
+	uint8_t buf[SOSC_IPC_MAX_FRAME];
 	DWORD written;
 	size_t bufsiz;
 
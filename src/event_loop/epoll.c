@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "config-autogen.h"
+
+#include "serialosc.h"
+#include "timer.h"
+
+#define MONOME_EVENT 0
+#define OSC_EVENT    1
+#define TIMER_EVENT  2
+
+static int add_fd(int epfd, int fd, uint32_t which) {
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data   = {.u32 = which}
+	};
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int sosc_event_loop(sosc_state_t *state) {
+	struct epoll_event events[3];
+	int epfd, nfds, i;
+
+#ifdef HAVE_TIMERFD
+	uint64_t deadline, armed = 0;
+	int tfd;
+#endif
+
+	if( (epfd = epoll_create(3)) < 0 ) {
+		perror("error in epoll_create()");
+		return 1;
+	}
+
+	if( add_fd(epfd, monome_get_fd(state->monome), MONOME_EVENT)
+	    || add_fd(epfd, lo_server_get_socket_fd(state->server), OSC_EVENT) ) {
+		perror("error in epoll_ctl()");
+		goto err;
+	}
+
+#ifdef HAVE_TIMERFD
+	if( (tfd = sosc_timer_new()) < 0 ) {
+		perror("error in timerfd_create()");
+		goto err;
+	}
+
+	if( add_fd(epfd, tfd, TIMER_EVENT) ) {
+		perror("error in epoll_ctl()");
+		goto err_timer;
+	}
+#endif
+
+	do {
+		/* block until either the monome or liblo have data */
+		if( (nfds = epoll_wait(epfd, events, 3, SOSC_WAIT_TIMEOUT(state))) < 0 )
+			switch( errno ) {
+			case EINTR:
+			case EAGAIN:
+				/* a signal (SIGUSR1, see src/latency.c) should still get
+				   the timers run, so carry on as if we'd timed out */
+				nfds = 0;
+				break;
+
+			default:
+				perror("error in epoll_wait()");
+				goto err_timer;
+			}
+
+		sosc_latency_woke(state);
+
+		for( i = 0; i < nfds; i++ ) {
+			switch( events[i].data.u32 ) {
+			case MONOME_EVENT:
+				/* is the monome still connected? */
+				if( events[i].events & (EPOLLHUP | EPOLLERR) )
+					goto err_timer;
+
+				sosc_server_drain_monome(state);
+				break;
+
+			case OSC_EVENT:
+				sosc_server_drain_osc(state);
+				break;
+
+#ifdef HAVE_TIMERFD
+			case TIMER_EVENT:
+				sosc_timer_ack(tfd);
+				armed = 0;
+				break;
+#endif
+			}
+		}
+
+		sosc_server_run_timers(state);
+
+#ifdef HAVE_TIMERFD
+		if( (deadline = sosc_server_next_deadline(state)) != armed ) {
+			sosc_timer_arm(tfd, deadline);
+			armed = deadline;
+		}
+#endif
+	} while( 1 );
+
+err_timer:
+#ifdef HAVE_TIMERFD
+	close(tfd);
+#endif
+err:
+	close(epfd);
+	return 1;
+}
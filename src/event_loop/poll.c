@@ -16,13 +16,22 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
 #include <poll.h>
 
+#include "config-autogen.h"
+
 #include "serialosc.h"
+#include "timer.h"
+
 
+int sosc_event_loop(sosc_state_t *state) {
+	struct pollfd fds[3];
+	int nfds = 2;
 
-int sosc_event_loop(const sosc_state_t *state) {
-	struct pollfd fds[2];
+#ifdef HAVE_TIMERFD
+	uint64_t deadline, armed = 0;
+#endif
 
 	fds[0].fd = monome_get_fd(state->monome);
 	fds[1].fd = lo_server_get_socket_fd(state->server);
@@ -30,29 +39,66 @@ int sosc_event_loop(const sosc_state_t *state) {
 	fds[0].events = POLLIN;
 	fds[1].events = POLLIN;
 
+#ifdef HAVE_TIMERFD
+	if( (fds[2].fd = sosc_timer_new()) < 0 ) {
+		perror("error in timerfd_create()");
+		return 1;
+	}
+
+	fds[2].events = POLLIN;
+	nfds = 3;
+#endif
+
 	do {
 		/* block until either the monome or liblo have data */
-		if( poll(fds, 2, -1) < 0 )
+		if( poll(fds, nfds, SOSC_WAIT_TIMEOUT(state)) < 0 )
 			switch( errno ) {
 			case EINVAL:
 				perror("error in poll()");
-				return 1;
+				goto out;
 
 			case EINTR:
 			case EAGAIN:
-				continue;
+				/* a signal (SIGUSR1, see src/latency.c) should still get
+				   the timers run, so carry on as if we'd timed out */
+				fds[0].revents = fds[1].revents = fds[2].revents = 0;
+				break;
 			}
 
+		sosc_latency_woke(state);
+
 		/* is the monome still connected? */
 		if( fds[0].revents & (POLLHUP | POLLERR) )
-			return 1;
+			goto out;
 
 		/* is there data available for reading from the monome? */
 		if( fds[0].revents & POLLIN )
-			monome_event_handle_next(state->monome);
+			sosc_server_drain_monome(state);
 
 		/* how about from OSC? */
 		if( fds[1].revents & POLLIN )
-			lo_server_recv_noblock(state->server, 0);
+			sosc_server_drain_osc(state);
+
+#ifdef HAVE_TIMERFD
+		if( fds[2].revents & POLLIN ) {
+			sosc_timer_ack(fds[2].fd);
+			armed = 0;
+		}
+#endif
+
+		sosc_server_run_timers(state);
+
+#ifdef HAVE_TIMERFD
+		if( (deadline = sosc_server_next_deadline(state)) != armed ) {
+			sosc_timer_arm(fds[2].fd, deadline);
+			armed = deadline;
+		}
+#endif
 	} while( 1 );
+
+out:
+#ifdef HAVE_TIMERFD
+	close(fds[2].fd);
+#endif
+	return 1;
 }
@@ -21,9 +21,10 @@
 #include "serialosc.h"
 
 
-int sosc_event_loop(const sosc_state_t *state) {
+int sosc_event_loop(sosc_state_t *state) {
+	struct timeval tv, *tvp;
 	fd_set rfds, efds;
-	int maxfd, mfd, lofd;
+	int maxfd, mfd, lofd, timeout;
 
 	mfd  = monome_get_fd(state->monome);
 	lofd = lo_server_get_socket_fd(state->server);
@@ -37,8 +38,16 @@ int sosc_event_loop(const sosc_state_t *state) {
 		FD_ZERO(&efds);
 		FD_SET(mfd, &efds);
 
+		tvp = NULL;
+
+		if( (timeout = sosc_server_timeout(state)) >= 0 ) {
+			tv.tv_sec  = timeout / 1000;
+			tv.tv_usec = (timeout % 1000) * 1000;
+			tvp = &tv;
+		}
+
 		/* block until either the monome or liblo have data */
-		if( select(maxfd, &rfds, NULL, &efds, NULL) < 0 )
+		if( select(maxfd, &rfds, NULL, &efds, tvp) < 0 )
 			switch( errno ) {
 			case EBADF:
 			case EINVAL:
@@ -46,19 +55,27 @@ int sosc_event_loop(const sosc_state_t *state) {
 				return 1;
 
 			case EINTR:
-				continue;
+				/* a signal (SIGUSR1, see src/latency.c) should still get
+				   the timers run, so carry on as if we'd timed out */
+				FD_ZERO(&rfds);
+				FD_ZERO(&efds);
+				break;
 			}
 
+		sosc_latency_woke(state);
+
 		/* is the monome still connected? */
 		if( FD_ISSET(mfd, &efds) )
 			return 1;
 
 		/* is there data available for reading from the monome? */
 		if( FD_ISSET(mfd, &rfds) )
-			monome_event_handle_next(state->monome);
+			sosc_server_drain_monome(state);
 
 		/* how about from OSC? */
 		if( FD_ISSET(lofd, &rfds) )
-			lo_server_recv_noblock(state->server, 0);
+			sosc_server_drain_osc(state);
+
+		sosc_server_run_timers(state);
 	} while( 1 );
 }
@@ -16,28 +16,27 @@
 
 #include <stdio.h>
 
+#include <Winsock2.h>
 #include <windows.h>
-#include <Winsock.h>
 #include <io.h>
 
 #include "serialosc.h"
 
-static DWORD WINAPI lo_thread(LPVOID param) {
-	sosc_state_t *state = param;
+/* the serial port and the OSC socket are both waited on from this one
+   thread, so that (as on every other platform) the state is only ever
+   touched by the loop which drives it. */
 
-	while( 1 )
-		lo_server_recv(state->server);
+#define MONOME_EVENT (WAIT_OBJECT_0)
+#define OSC_EVENT    (WAIT_OBJECT_0 + 1)
 
-	return 0;
-}
-
-int sosc_event_loop(const sosc_state_t *state) {
+int sosc_event_loop(sosc_state_t *state) {
 	OVERLAPPED ov = {0, 0, {{0, 0}}};
-	HANDLE hres, lo_thd_res;
-	DWORD evt_mask;
+	HANDLE hres, events[2];
+	WSAEVENT osc_event;
+	DWORD evt_mask, timeout;
+	int waiting = 0;
 
 	hres = (HANDLE) _get_osfhandle(monome_get_fd(state->monome));
-	lo_thd_res = CreateThread(NULL, 0, lo_thread, (void *) state, 0, NULL);
 
 	if( !(ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
 		fprintf(stderr, "serialosc: event_loop: can't allocate event (%ld)\n",
@@ -45,39 +44,88 @@ int sosc_event_loop(const sosc_state_t *state) {
 		return 1;
 	}
 
+	if( (osc_event = WSACreateEvent()) == WSA_INVALID_EVENT ) {
+		fprintf(stderr, "serialosc: event_loop: can't allocate event (%d)\n",
+		        WSAGetLastError());
+		goto err_osc_event;
+	}
+
+	/* this also makes the socket non-blocking, which liblo doesn't mind */
+	if( WSAEventSelect(lo_server_get_socket_fd(state->server),
+	                   osc_event, FD_READ) ) {
+		fprintf(stderr, "serialosc: event_loop: can't watch socket (%d)\n",
+		        WSAGetLastError());
+		goto err_select;
+	}
+
+	events[0] = ov.hEvent;
+	events[1] = osc_event;
+
 	do {
-		SetCommMask(hres, EV_RXCHAR);
+		/* the last WaitCommEvent() is still outstanding if it was the
+		   socket or a deadline which woke us up */
+		if( !waiting ) {
+			SetCommMask(hres, EV_RXCHAR);
+
+			if( !WaitCommEvent(hres, &evt_mask, &ov) )
+				switch( GetLastError() ) {
+				case ERROR_IO_PENDING:
+					break;
+
+				case ERROR_ACCESS_DENIED:
+					/* evidently we get this when the monome is unplugged? */
+					goto out;
+
+				default:
+					fprintf(stderr, "event_loop() error: %ld\n", GetLastError());
+					goto out;
+				}
+
+			waiting = 1;
+		}
 
-		if( !WaitCommEvent(hres, &evt_mask, &ov) )
-			switch( GetLastError() ) {
-			case ERROR_IO_PENDING:
-				break;
+		timeout = sosc_server_timeout(state);
+		if( timeout == (DWORD) -1 )
+			timeout = INFINITE;
 
-			case ERROR_ACCESS_DENIED:
-				/* evidently we get this when the monome is unplugged? */
-				return 1;
+		switch( WaitForMultipleObjects(2, events, FALSE, timeout) ) {
+		case MONOME_EVENT:
+			sosc_latency_woke(state);
+			waiting = 0;
+
+			sosc_server_drain_monome(state);
+			sosc_server_run_timers(state);
+			break;
 
-			default:
-				fprintf(stderr, "event_loop() error: %d\n", GetLastError());
-				return 1;
-			}
+		case OSC_EVENT:
+			sosc_latency_woke(state);
 
-		switch( WaitForSingleObject(ov.hEvent, INFINITE) ) {
-		case WAIT_OBJECT_0:
-			while( monome_event_handle_next(state->monome) );
+			/* FD_READ is re-enabled by each recv(), so if there's still
+			   anything left after this, the event gets set again. */
+			WSAResetEvent(osc_event);
+			sosc_server_drain_osc(state);
+			sosc_server_run_timers(state);
 			break;
 
 		case WAIT_TIMEOUT:
+			sosc_latency_woke(state);
+			sosc_server_run_timers(state);
 			break;
 
-		case WAIT_ABANDONED_0:
 		case WAIT_FAILED:
 			fprintf(stderr, "event_loop(): wait failed: %ld\n",
 			        GetLastError());
-			return 1;
+			goto out;
 		}
 	} while ( 1 );
 
-	((void) lo_thd_res); /* shut GCC up about this being an unused variable */
-	return 0;
+out:
+	/* cancels the outstanding WaitCommEvent(), if there is one */
+	SetCommMask(hres, 0);
+	WSAEventSelect(lo_server_get_socket_fd(state->server), osc_event, 0);
+err_select:
+	WSACloseEvent(osc_event);
+err_osc_event:
+	CloseHandle(ov.hEvent);
+	return 1;
 }
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <monome.h>
+
+#include "serialosc.h"
+
+/* rate-limited LED output.
+
+   with an LED rate configured, the grid handlers in mext_methods.c write
+   into state->frame instead of talking to the device. the event loop
+   then calls sosc_frame_service() whenever sosc_frame_deadline() comes
+   around, which sends each dirty quad out as a single map message. the
+   shadow framebuffer still weeds out quads that haven't actually changed.
+
+   the frame is in application coordinates, same as the shadow. */
+
+#define QUADS_PER_ROW (SOSC_MAX_GRID_SIZE / 8)
+#define QUAD_BIT(x, y) (1 << (((y) / 8) * QUADS_PER_ROW + ((x) / 8)))
+
+#define RATE(state) ((state)->config.dev.led_rate)
+
+
+void sosc_frame_set(sosc_state_t *state, int x, int y, int level)
+{
+	uint8_t *cur;
+
+	if (x < 0 || y < 0 || x >= state->shadow.cols || y >= state->shadow.rows)
+		return;
+
+	if (level < 0)
+		level = 0;
+	else if (level > 15)
+		level = 15;
+
+	cur = &state->frame.levels[y][x];
+
+	if (*cur == level)
+		return;
+
+	*cur = level;
+	state->frame.dirty |= QUAD_BIT(x, y);
+}
+
+void sosc_frame_fill(sosc_state_t *state, int level)
+{
+	int x, y;
+
+	for (y = 0; y < state->shadow.rows; y++)
+		for (x = 0; x < state->shadow.cols; x++)
+			sosc_frame_set(state, x, y, level);
+}
+
+/* send the whole frame again, i.e. after the shadow has been knocked
+   out of sync by a rotation. */
+void sosc_frame_redraw(sosc_state_t *state)
+{
+	if (RATE(state))
+		state->frame.dirty = ~0;
+}
+
+uint64_t sosc_frame_deadline(const sosc_state_t *state)
+{
+	if (!RATE(state) || !state->frame.dirty)
+		return 0;
+
+	/* next_flush starts out at 0, so make sure we don't tell the event
+	   loop there's nothing to do. */
+	return state->frame.next_flush ? state->frame.next_flush : 1;
+}
+
+static void flush_quad(sosc_state_t *state, int x_off, int y_off)
+{
+	uint8_t levels[64], bits[8];
+	int x, y, level, changed, varibright;
+
+	changed = varibright = 0;
+	memset(bits, 0, sizeof(bits));
+
+	for (y = 0; y < 8; y++) {
+		for (x = 0; x < 8; x++) {
+			level = state->frame.levels[y_off + y][x_off + x];
+
+			changed |= sosc_shadow_update(
+				&state->shadow, x_off + x, y_off + y, level);
+
+			levels[(y * 8) + x] = level;
+
+			if (level == 15)
+				bits[y] |= 1 << x;
+			else if (level)
+				varibright = 1;
+		}
+	}
+
+	if (!changed)
+		return;
+
+	/* plain on/off quads get the smaller message */
+	if (varibright)
+		sosc_server_serial_written(state,
+			monome_led_level_map(state->monome, x_off, y_off, levels));
+	else
+		sosc_server_serial_written(state,
+			monome_led_map(state->monome, x_off, y_off, bits));
+}
+
+void sosc_frame_service(sosc_state_t *state)
+{
+	uint64_t now;
+	int x, y;
+
+	if (!sosc_frame_deadline(state))
+		return;
+
+	now = sosc_monotonic_us();
+
+	if (now < state->frame.next_flush)
+		return;
+
+	for (y = 0; y < state->shadow.rows; y += 8)
+		for (x = 0; x < state->shadow.cols; x += 8)
+			if (state->frame.dirty & QUAD_BIT(x, y))
+				flush_quad(state, x, y);
+
+	state->frame.dirty = 0;
+	state->frame.next_flush = now + (1000000 / RATE(state));
+}
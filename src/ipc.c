@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -25,140 +26,40 @@
 
 #define IPC_MAGIC 0x505C /* SOSC, get it? */
 
+/* on a file descriptor, each message is sent as a frame: its length, as
+   an sosc_ipc_frame_len_t, and then the message as serialized by
+   sosc_ipc_msg_to_buf(). knowing the length up front means the reader
+   can pull in whatever's available without blocking and pick complete
+   messages out of its buffer, see sosc_ipc_reader_next(). */
+typedef uint16_t sosc_ipc_frame_len_t;
+
 /*************************************************************************
  * i/o from file descriptors
  *************************************************************************/
 
-static int read_strdata(int fd, size_t n, ...)
-{
-	const char **cur;
-	uint16_t magic;
-	size_t slen;
-	va_list ap;
-	char *buf;
-
-	va_start(ap, n);
-
-	while (n--) {
-		cur = va_arg(ap, const char **);
-		*cur = NULL;
-
-		if (read(fd, &slen, sizeof(slen)) < sizeof(slen))
-			return -1;
-
-		if (!(buf = s_calloc(slen + 1, sizeof(char)))) {
-			/* XXX: proper error handling? i.e. what do we do with the
-			        strings that are already allocated? we can't NULL
-			        all of them at the start, I guess that's up to the
-					caller? */
-			continue;
-		}
-
-		if (read(fd, buf, slen) < slen) {
-			s_free(buf);
-			return -1;
-		}
-
-		*cur = buf;
-
-		if (read(fd, &magic, sizeof(magic)) < sizeof(magic)
-			|| magic != IPC_MAGIC)
-			return -1;
-	}
-
-	va_end(ap);
-
-	return 0;
-}
-
-static int write_strdata(int fd, size_t n, ...)
-{
-	uint16_t magic = IPC_MAGIC;
-	const char *cur;
-	size_t slen;
-	va_list ap;
-
-#define EMIT_BYTES(b, nb)          \
-	do {                           \
-		if (write(fd, b, nb) < nb) \
-			return -1;             \
-	} while (0)
-
-#define EMIT_VAR(v) EMIT_BYTES(&v, sizeof(v))
-
-	va_start(ap, n);
-	while (n--) {
-		cur = va_arg(ap, const char *);
-		slen = strlen(cur);
-
-		EMIT_VAR(slen);
-		EMIT_BYTES(cur, slen);
-		EMIT_VAR(magic);
-	}
-	va_end(ap);
-
-#undef EMIT_VAR
-#undef EMIT_BYTES
-
-	return 0;
-}
-
+/* the whole frame goes out in one write(), and since it's no bigger
+   than PIPE_BUF, it arrives in one piece even with several writers on
+   the same pipe. */
 int sosc_ipc_msg_write(int fd, sosc_ipc_msg_t *msg)
 {
-	ssize_t written;
+	uint8_t buf[sizeof(sosc_ipc_frame_len_t) + SOSC_IPC_MAX_FRAME];
+	sosc_ipc_frame_len_t flen;
+	ssize_t len, written;
 
-	msg->magic = IPC_MAGIC;
+	len = sosc_ipc_msg_to_buf(buf + sizeof(flen), SOSC_IPC_MAX_FRAME, msg);
 
-	if ((written = write(fd, msg, sizeof(*msg))) < sizeof(*msg))
+	if (len < 0)
 		return -1;
 
-	switch (msg->type) {
-	case SOSC_DEVICE_CONNECTION:
-		if (write_strdata(fd, 1, msg->connection.devnode))
-			return -1;
+	flen = len;
+	memcpy(buf, &flen, sizeof(flen));
+	len += sizeof(flen);
 
-		break;
+	do {
+		written = write(fd, buf, len);
+	} while (written < 0 && errno == EINTR);
 
-	case SOSC_DEVICE_INFO:
-		if (write_strdata(fd, 2, msg->device_info.serial,
-		                  msg->device_info.friendly))
-			return -1;
-
-	default:
-		break;
-	}
-
-	return written;
-}
-
-int sosc_ipc_msg_read(int fd, sosc_ipc_msg_t *buf)
-{
-	ssize_t nbytes;
-
-	if ((nbytes = read(fd, buf, sizeof(*buf))) < sizeof(*buf)
-		|| buf->magic != IPC_MAGIC)
-		return -1;
-
-	switch (buf->type) {
-	case SOSC_DEVICE_CONNECTION:
-		buf->connection.devnode = NULL;
-		if (read_strdata(fd, 1, &buf->connection.devnode))
-			return -1;
-
-		break;
-
-	case SOSC_DEVICE_INFO:
-		buf->device_info.serial = buf->device_info.friendly = NULL;
-
-		if (read_strdata(fd, 2, &buf->device_info.serial,
-		                 &buf->device_info.friendly))
-			return -1;
-
-	default:
-		break;
-	}
-
-	return nbytes;
+	return (written < len) ? -1 : written;
 }
 
 /*************************************************************************
@@ -229,14 +130,14 @@ ssize_t sosc_ipc_msg_to_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t *msg)
 
 	switch (msg->type) {
 	case SOSC_DEVICE_CONNECTION:
-		strbytes = strdata_to_buf(buf, nbytes, 1, msg->connection.devnode);
+		strbytes = strdata_to_buf(buf, avail, 1, msg->connection.devnode);
 
 		if (strbytes < 0)
 			return -1;
 		break;
 
 	case SOSC_DEVICE_INFO:
-		strbytes = strdata_to_buf(buf, nbytes, 2, msg->device_info.serial,
+		strbytes = strdata_to_buf(buf, avail, 2, msg->device_info.serial,
 								  msg->device_info.friendly);
 
 		if (strbytes < 0)
@@ -246,6 +147,7 @@ ssize_t sosc_ipc_msg_to_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t *msg)
 	case SOSC_DEVICE_READY:
 	case SOSC_DEVICE_DISCONNECTION:
 	case SOSC_OSC_PORT_CHANGE:
+	case SOSC_DEVICE_STATS:
 		strbytes = 0;
 		break;
 
@@ -336,7 +238,7 @@ ssize_t sosc_ipc_msg_from_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t **msg)
 		(*msg)->connection.devnode = NULL;
 
 		strbytes = strdata_from_buf(
-			buf, nbytes, 1,
+			buf, avail, 1,
 			&(*msg)->connection.devnode);
 
 		if (strbytes < 0)
@@ -347,7 +249,7 @@ ssize_t sosc_ipc_msg_from_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t **msg)
 		(*msg)->device_info.serial = (*msg)->device_info.friendly = NULL;
 
 		strbytes = strdata_from_buf(
-			buf, nbytes, 2,
+			buf, avail, 2,
 			&(*msg)->device_info.serial,
 			&(*msg)->device_info.friendly);
 
@@ -358,6 +260,7 @@ ssize_t sosc_ipc_msg_from_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t **msg)
 	case SOSC_DEVICE_READY:
 	case SOSC_DEVICE_DISCONNECTION:
 	case SOSC_OSC_PORT_CHANGE:
+	case SOSC_DEVICE_STATS:
 		strbytes = 0;
 		break;
 
@@ -372,3 +275,66 @@ invalid_msg:
 	*msg = NULL;
 	return -1;
 }
+
+/*************************************************************************
+ * buffered, non-blocking reads
+ *************************************************************************/
+
+void sosc_ipc_reader_init(sosc_ipc_reader_t *r)
+{
+	r->len = 0;
+}
+
+/* reads whatever is waiting on fd into the buffer. returns the number of
+   bytes read, 0 if there was nothing to read, or -1 if the other end has
+   gone away. */
+ssize_t sosc_ipc_reader_fill(sosc_ipc_reader_t *r, int fd)
+{
+	ssize_t nbytes;
+
+	if (r->len == sizeof(r->buf))
+		return 0;
+
+	nbytes = read(fd, r->buf + r->len, sizeof(r->buf) - r->len);
+
+	if (nbytes < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	else if (!nbytes)
+		return -1;
+
+	r->len += nbytes;
+	return nbytes;
+}
+
+/* picks the next complete message out of the buffer. returns 1 if one
+   was copied into msg, 0 if there isn't a whole one there yet, or -1 if
+   the stream is corrupt. the strings in msg belong to the caller. */
+int sosc_ipc_reader_next(sosc_ipc_reader_t *r, sosc_ipc_msg_t *msg)
+{
+	sosc_ipc_frame_len_t flen;
+	sosc_ipc_msg_t *parsed;
+	size_t total;
+
+	if (r->len < sizeof(flen))
+		return 0;
+
+	memcpy(&flen, r->buf, sizeof(flen));
+
+	if (flen < sizeof(*msg) || flen > SOSC_IPC_MAX_FRAME)
+		return -1;
+
+	total = sizeof(flen) + flen;
+
+	if (r->len < total)
+		return 0;
+
+	if (sosc_ipc_msg_from_buf(r->buf + sizeof(flen), flen, &parsed) < 0)
+		return -1;
+
+	memcpy(msg, parsed, sizeof(*msg));
+
+	r->len -= total;
+	memmove(r->buf, r->buf + total, r->len);
+
+	return 1;
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_SOURCE /* for SIGUSR1 */
+
+#include <stdio.h>
+#include <signal.h>
+
+#include <monome.h>
+
+#include "serialosc.h"
+
+/* latency histograms, for chasing the odd slow event down to the host,
+   libmonome, or us.
+
+   the event loops stamp the time whenever they wake up, and everything
+   after that is measured from the stamp: device events through to being
+   sent (or bundled), and OSC datagrams through to their handler having
+   written to the device (LED writes held for a frame aren't counted).
+   how late the stamp is for whatever deadline the loop was waiting on
+   is the jitter.
+
+   each histogram belongs to the loop driving its state and nothing else
+   touches it, so recording is a clock read and an increment. they can
+   be dumped with /sys/latency (see src/osc/sys_methods.c), or to stderr
+   by sending the process SIGUSR1. */
+
+#define SUB_BUCKETS (1 << SOSC_HIST_SUB_BITS)
+
+static int magnitude(uint64_t v)
+{
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(v);
+#else
+	int m = 0;
+
+	while (v >>= 1)
+		m++;
+
+	return m;
+#endif
+}
+
+static int bucket_index(uint64_t v)
+{
+	int m;
+
+	if (v < SUB_BUCKETS)
+		return v;
+
+	if ((m = magnitude(v)) >= SOSC_HIST_MAX_BITS)
+		return SOSC_HIST_BUCKETS - 1;
+
+	return ((m - SOSC_HIST_SUB_BITS + 1) << SOSC_HIST_SUB_BITS)
+		+ ((v >> (m - SOSC_HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* the highest value which lands in bucket i */
+static uint64_t bucket_value(int i)
+{
+	uint64_t low;
+	int shift;
+
+	if (i < SUB_BUCKETS)
+		return i;
+
+	shift = (i >> SOSC_HIST_SUB_BITS) - 1;
+	low = (uint64_t) (SUB_BUCKETS + (i & (SUB_BUCKETS - 1))) << shift;
+
+	return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void sosc_histogram_record(sosc_histogram_t *h, uint64_t ns)
+{
+	h->buckets[bucket_index(ns)]++;
+	h->count++;
+
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* per mille, so p99.9 doesn't need floats */
+static uint64_t percentile(const sosc_histogram_t *h, int pm)
+{
+	uint64_t target, seen, v;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	target = (h->count * pm + 999) / 1000;
+
+	for (seen = 0, i = 0; i < SOSC_HIST_BUCKETS; i++) {
+		if ((seen += h->buckets[i]) >= target)
+			break;
+	}
+
+	v = bucket_value(i);
+	return (v < h->max) ? v : h->max;
+}
+
+/* fills in SOSC_HIST_SUMMARY values, all but the count in nanoseconds */
+void sosc_histogram_summary(const sosc_histogram_t *h, uint64_t *v)
+{
+	v[0] = h->count;
+	v[1] = percentile(h, 500);
+	v[2] = percentile(h, 900);
+	v[3] = percentile(h, 990);
+	v[4] = percentile(h, 999);
+	v[5] = h->max;
+}
+
+/**
+ * dumping on SIGUSR1
+ *
+ * the handler just counts requests. each loop notices the count has
+ * moved the next time it runs its timers, which for a loop the signal
+ * didn't interrupt (i.e. a hosted device on another worker thread) may
+ * not be until its next event.
+ */
+
+static volatile sig_atomic_t dump_requests;
+
+#ifdef SIGUSR1
+static void request_dump(int sig)
+{
+	dump_requests++;
+}
+#endif
+
+void sosc_latency_catch_signal()
+{
+#ifdef SIGUSR1
+	/* not signal(), which in strict POSIX mode resets the handler once
+	   it's run, so that a second SIGUSR1 would kill us. */
+	struct sigaction sa;
+
+	sa.sa_handler = request_dump;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGUSR1, &sa, NULL);
+#endif
+}
+
+void sosc_latency_init(sosc_state_t *state)
+{
+	state->latency.dumped = dump_requests;
+}
+
+static void dump_one(sosc_state_t *state, const char *what,
+                     const sosc_histogram_t *h)
+{
+	uint64_t v[SOSC_HIST_SUMMARY];
+
+	sosc_histogram_summary(h, v);
+
+	fprintf(stderr, "serialosc [%s]: %-8s %8llu samples, p50 %.1fus, "
+	        "p90 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+	        monome_get_serial(state->monome), what,
+	        (unsigned long long) v[0], v[1] / 1e3, v[2] / 1e3,
+	        v[3] / 1e3, v[4] / 1e3, v[5] / 1e3);
+}
+
+void sosc_latency_dump(sosc_state_t *state)
+{
+	dump_one(state, "input",  &state->latency.input);
+	dump_one(state, "output", &state->latency.output);
+	dump_one(state, "jitter", &state->latency.jitter);
+}
+
+void sosc_latency_service(sosc_state_t *state)
+{
+	int requests = dump_requests;
+
+	if (state->latency.dumped == requests)
+		return;
+
+	state->latency.dumped = requests;
+	sosc_latency_dump(state);
+}
+
+/**
+ * recording
+ */
+
+/* the event loops call this as soon as they wake up, before they handle
+   anything. the state's deadlines haven't moved since they went to
+   sleep, so we can tell how late they are for them. */
+void sosc_latency_woke(sosc_state_t *state)
+{
+	uint64_t deadline, now;
+
+	now = sosc_monotonic_ns();
+	deadline = sosc_server_next_deadline(state) * 1000;
+
+	if (deadline && now >= deadline)
+		sosc_histogram_record(&state->latency.jitter, now - deadline);
+
+	state->latency.woke = now;
+}
+
+void sosc_latency_since_woke(sosc_state_t *state, sosc_histogram_t *h)
+{
+	if (state->latency.woke)
+		sosc_histogram_record(h, sosc_monotonic_ns() - state->latency.woke);
+}
@@ -0,0 +1,428 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config-autogen.h"
+
+#ifdef HAVE_RECVMMSG
+#define _GNU_SOURCE /* for recvmmsg() */
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/* fast path for the mext methods.
+
+   liblo matches every incoming message against every registered method
+   with a string compare, and coerces each argument through an lo_arg.
+   the LED methods are by far the busiest thing we do, so we pick those
+   out of the packet ourselves: check the prefix, look the rest of the
+   path up in a perfect hash of osc_mext_methods, decode the arguments
+   straight into ints and call the method.
+
+   anything we don't recognise (bundles, /sys methods, blobs, strings,
+   unknown paths, wrong argument counts) is handed to liblo untouched.
+   liblo has a single catch-all method for the mext methods (see
+   osc_register_methods()) which uses the same lookup.
+
+   the prefix is only ever compared against here, so changing it is a
+   matter of swapping state->dispatch.prefix. nothing is registered or
+   unregistered with liblo, and no message is ever matched against a
+   half-changed set of methods. */
+
+#define NO_METHOD -1
+
+/* how hard osc_dispatch_build() tries before giving up and leaving
+   everything to liblo. in practice a seed turns up within a few dozen
+   tries. */
+#define MAX_SEED 65536
+
+static uint32_t hash(const char *s, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	/* FNV-1a */
+	while (*s) {
+		h ^= (uint8_t) *s++;
+		h *= 16777619u;
+	}
+
+	return h & (SOSC_DISPATCH_SLOTS - 1);
+}
+
+void osc_dispatch_build(sosc_state_t *state)
+{
+	const sosc_osc_method_t *m;
+	uint32_t seed, slot;
+
+	for (seed = 0; seed < MAX_SEED; seed++) {
+		memset(state->dispatch.slots, NO_METHOD,
+		       sizeof(state->dispatch.slots));
+
+		for (m = osc_mext_methods; m->path; m++) {
+			/* state->stats.mext_calls has to have room */
+			assert(m - osc_mext_methods < SOSC_MAX_MEXT_METHODS);
+
+			slot = hash(m->path, seed);
+
+			if (state->dispatch.slots[slot] != NO_METHOD)
+				break;
+
+			state->dispatch.slots[slot] = m - osc_mext_methods;
+		}
+
+		if (!m->path) {
+			state->dispatch.seed = seed;
+			return;
+		}
+	}
+
+	/* no luck, liblo will have to do it all. */
+	memset(state->dispatch.slots, NO_METHOD, sizeof(state->dispatch.slots));
+}
+
+void osc_dispatch_set_prefix(sosc_state_t *state, char *prefix)
+{
+	state->config.app.osc_prefix = prefix;
+
+	state->dispatch.prefix.len = strlen(prefix);
+	state->dispatch.prefix.str = prefix;
+}
+
+/* finds the mext method for a full path, or NULL if there isn't one */
+const sosc_osc_method_t *osc_dispatch_lookup(const sosc_state_t *state,
+                                             const char *path)
+{
+	const sosc_osc_method_t *m;
+	size_t plen;
+	int slot;
+
+	plen = state->dispatch.prefix.len;
+
+	if (strncmp(path, state->dispatch.prefix.str, plen) || path[plen] != '/')
+		return NULL;
+
+	path += plen + 1;
+	slot = state->dispatch.slots[hash(path, state->dispatch.seed)];
+
+	if (slot == NO_METHOD)
+		return NULL;
+
+	m = &osc_mext_methods[slot];
+
+	if (strcmp(path, m->path))
+		return NULL;
+
+	return m;
+}
+
+/* returns the offset of the next field, or 0 if the string runs off the
+   end of the packet. */
+static size_t osc_string(const uint8_t *buf, size_t len, size_t off)
+{
+	const uint8_t *end;
+
+	if (off >= len || !(end = memchr(buf + off, '\0', len - off)))
+		return 0;
+
+	off = ((end - buf) + 4) & ~3;
+	return (off > len) ? 0 : off;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+/* size of an argument in the packet, or 0 if it isn't numeric */
+static size_t arg_size(char type)
+{
+	switch (type) {
+	case 'i':
+	case 'f':
+		return 4;
+
+	case 'h':
+	case 'd':
+		return 8;
+
+	default:
+		return 0;
+	}
+}
+
+/* decodes an argument the way lo_coerce() would coerce it to an int32 */
+static int32_t decode_arg(char type, const uint8_t *p)
+{
+	union { uint32_t i; float f; } u32;
+	union { uint64_t i; double d; } u64;
+
+	switch (type) {
+	case 'f':
+		u32.i = be32(p);
+		return (int32_t) u32.f;
+
+	case 'h':
+		u64.i = ((uint64_t) be32(p) << 32) | be32(p + 4);
+		return (int32_t) (int64_t) u64.i;
+
+	case 'd':
+		u64.i = ((uint64_t) be32(p) << 32) | be32(p + 4);
+		return (int32_t) u64.d;
+
+	default:
+		return (int32_t) be32(p);
+	}
+}
+
+/* returns 0 if the message was handled, nonzero if it should go to
+   liblo instead. */
+int osc_dispatch(sosc_state_t *state, const uint8_t *buf, size_t len)
+{
+	int32_t argv[OSC_MEXT_MAX_ARGS];
+	const sosc_osc_method_t *m;
+	const char *types;
+	size_t off, argsize;
+	int argc;
+
+	/* bundles start with "#bundle", and so don't start with a slash */
+	if (!len || *buf != '/')
+		return 1;
+
+	if (!(off = osc_string(buf, len, 0)))
+		return 1;
+
+	if (!(m = osc_dispatch_lookup(state, (const char *) buf)) || !m->func)
+		return 1;
+
+	/* no typetag string? then liblo can puzzle it out. */
+	types = (const char *) buf + off;
+
+	if (off >= len || *types != ',' || !(off = osc_string(buf, len, off)))
+		return 1;
+
+	types++;
+	argc = strlen(types);
+
+	if (argc > OSC_MEXT_MAX_ARGS
+	    || (m->typespec && argc != strlen(m->typespec)))
+		return 1;
+
+	for (argc = 0; types[argc]; argc++) {
+		argsize = arg_size(types[argc]);
+
+		if (!argsize || off + argsize > len)
+			return 1;
+
+		argv[argc] = decode_arg(types[argc], buf + off);
+		off += argsize;
+	}
+
+	/* only now that liblo won't see it too, or mext_handler would count
+	   it a second time. */
+	state->stats.mext_calls[m - osc_mext_methods]++;
+
+	if (!m->func(state, argv, argc))
+		state->stats.mext_handled++;
+
+	return 0;
+}
+
+#ifndef WIN32
+static void handle_datagram(sosc_state_t *state, uint8_t *buf, size_t len)
+{
+	uint64_t start, end, elapsed, written;
+
+	start = sosc_monotonic_ns();
+	written = state->stats.serial_bytes;
+
+	if (osc_dispatch(state, buf, len))
+		lo_server_dispatch_data(state->server, buf, len);
+
+	end = sosc_monotonic_ns();
+	elapsed = end - start;
+
+	/* the datagram's been waiting since the loop woke up */
+	if (state->stats.serial_bytes != written && state->latency.woke)
+		sosc_histogram_record(&state->latency.output,
+		                      end - state->latency.woke);
+
+	state->stats.datagrams_in++;
+	state->stats.handler_ns_total += elapsed;
+
+	if (elapsed > state->stats.handler_ns_max)
+		state->stats.handler_ns_max = elapsed;
+}
+
+static void too_big(sosc_state_t *state)
+{
+	fprintf(stderr, "serialosc [%s]: dropped a datagram over %d bytes\n",
+	        monome_get_serial(state->monome), SOSC_RECV_BUF_SIZE);
+}
+
+#define RECV_BUF(state, i) ((state)->recv_bufs + (i) * SOSC_RECV_BUF_SIZE)
+
+#ifdef HAVE_RECVMMSG
+/* pulls up to SOSC_RECV_BATCH datagrams off the socket in one syscall. */
+static int recv_batch(sosc_state_t *state, int max)
+{
+	struct mmsghdr msgs[SOSC_RECV_BATCH];
+	struct iovec iovs[SOSC_RECV_BATCH];
+	int i, n;
+
+	if (max > SOSC_RECV_BATCH)
+		max = SOSC_RECV_BATCH;
+
+	for (i = 0; i < max; i++) {
+		iovs[i].iov_base = RECV_BUF(state, i);
+		iovs[i].iov_len  = SOSC_RECV_BUF_SIZE;
+
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov    = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = recvmmsg(lo_server_get_socket_fd(state->server),
+	             msgs, max, MSG_DONTWAIT, NULL);
+
+	if (n <= 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			too_big(state);
+		else
+			handle_datagram(state, RECV_BUF(state, i), msgs[i].msg_len);
+	}
+
+	return n;
+}
+#endif
+
+/* the receive buffers are per device rather than per thread, so that
+   threads which never receive anything (and there are a few) don't pay
+   for them. */
+int osc_recv_init(sosc_state_t *state)
+{
+	state->recv_bufs = s_malloc(SOSC_RECV_BATCH * SOSC_RECV_BUF_SIZE);
+	return (state->recv_bufs) ? 0 : -1;
+}
+
+void osc_recv_free(sosc_state_t *state)
+{
+	s_free(state->recv_bufs);
+	state->recv_bufs = NULL;
+}
+
+/* receives and handles up to max datagrams. returns the number handled,
+   or 0 if there wasn't anything waiting. */
+int osc_recv(sosc_state_t *state, int max)
+{
+#ifdef HAVE_RECVMMSG
+	return (max > 0) ? recv_batch(state, max) : 0;
+#else
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t len;
+	int n;
+
+	/* one at a time, but into the same buffer every time, since each
+	   datagram is done with before the next is read. */
+	for (n = 0; n < max; n++) {
+		iov.iov_base = RECV_BUF(state, 0);
+		iov.iov_len  = SOSC_RECV_BUF_SIZE;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = &iov;
+		msg.msg_iovlen = 1;
+
+		/* only linux reports a datagram's real length when asked to
+		   with MSG_TRUNC, but msg_flags says it was cut short anywhere */
+		len = recvmsg(lo_server_get_socket_fd(state->server),
+		              &msg, MSG_DONTWAIT);
+
+		if (len < 0)
+			break;
+
+		if (msg.msg_flags & MSG_TRUNC)
+			too_big(state);
+		else
+			handle_datagram(state, RECV_BUF(state, 0), len);
+	}
+
+	return n;
+#endif
+}
+#else
+/* windows: liblo does the receiving, a datagram at a time, and all of
+   them go through its own dispatch. */
+int osc_recv_init(sosc_state_t *state)
+{
+	return 0;
+}
+
+void osc_recv_free(sosc_state_t *state)
+{
+	return;
+}
+
+int osc_recv(sosc_state_t *state, int max)
+{
+	int n;
+
+	for (n = 0; n < max && lo_server_recv_noblock(state->server, 0); n++)
+		state->stats.datagrams_in++;
+
+	return n;
+}
+#endif
+
+/* liblo holds on to bundles timetagged in the future, and only hands
+   them out from its own receive calls (once they're within 10ms of
+   due). so while it's got any queued, we have to wake up for them. */
+uint64_t osc_queue_deadline(const sosc_state_t *state)
+{
+	if (!lo_server_events_pending(state->server))
+		return 0;
+
+	return sosc_monotonic_us()
+		+ (uint64_t) (lo_server_next_event_delay(state->server) * 1e6);
+}
+
+void osc_queue_service(sosc_state_t *state)
+{
+	int n;
+
+	/* each call hands out the bundles due at one timetag. the limit is
+	   just so that a misbehaving liblo can't wedge us here. */
+	for (n = 0; n < SOSC_RECV_BATCH
+	     && lo_server_events_pending(state->server)
+	     && lo_server_next_event_delay(state->server) < 0.01; n++)
+		lo_server_recv_noblock(state->server, 0);
+}
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <lo/lo.h>
 #include <monome.h>
@@ -34,322 +35,490 @@ static int coerce_arg_to_int(lo_type type, lo_arg *src)
 	return 0;
 }
 
-OSC_HANDLER_FUNC(led_set_handler) {
-	monome_t *monome = user_data;
-	return monome_led_set(monome, argv[0]->i, argv[1]->i, !!argv[2]->i);
+/* the mext methods only ever take integers, so they're written against
+   a plain array of them. that way src/osc/dispatch.c can call them
+   straight from the packet, and liblo gets a thin wrapper. */
+
+#define MEXT_FUNC(name)                                                  \
+	static int name(sosc_state_t *, const int32_t *, int);               \
+	OSC_HANDLER_FUNC(name##_handler) {                                    \
+		return call_mext_func(name, user_data, types, argv, argc);        \
+	}                                                                     \
+	static int name(sosc_state_t *state, const int32_t *argv, int argc)
+
+static int call_mext_func(sosc_mext_func_t *func, sosc_state_t *state,
+                          const char *types, lo_arg **argv, int argc)
+{
+	int32_t args[OSC_MEXT_MAX_ARGS];
+	int i;
+
+	if (argc > OSC_MEXT_MAX_ARGS)
+		return 1;
+
+	for (i = 0; i < argc; i++) {
+		if (coerce_arg_to_int(types[i], argv[i]))
+			return 1; /* only integers are invited to this party */
+
+		args[i] = argv[i]->i;
+	}
+
+	return func(state, args, argc);
 }
 
-OSC_HANDLER_FUNC(led_all_handler) {
-	monome_t *monome = user_data;
-	return monome_led_all(monome, !!argv[0]->i);
+/* libmonome returns the number of bytes it wrote, or -1. the mext
+   methods return 0 for success, like liblo handlers. */
+static int written(sosc_state_t *state, int ret)
+{
+	return sosc_server_serial_written(state, ret) < 0;
 }
 
-OSC_HANDLER_FUNC(led_map_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[8];
-	int i;
+/**
+ * LED write filtering
+ *
+ * each of these takes a grid LED write and returns nonzero if it should
+ * be passed on to libmonome.
+ *
+ * with an LED rate set, the write goes into the frame for the flush
+ * scheduler (see src/frame.c) and never is. otherwise, it's recorded in
+ * state->shadow, and writes which wouldn't change anything are dropped
+ * before they get anywhere near the serial port.
+ */
 
-	for( i = 0; i < 8; i++ )
-		buf[i] = argv[i + (argc - 8)]->i;
+#define ON_LEVEL(on) ((on) ? 15 : 0)
+#define FRAMED(state) ((state)->config.dev.led_rate > 0)
+
+/* quads start on multiples of 8. if an offset doesn't, we can't be sure
+   which LEDs the device will actually touch. this doesn't matter for the
+   frame, since the frame only ever sends whole quads. */
+#define QUAD_ALIGNED(off) (!((off) & 7))
+
+/* for a write which one of these swallowed */
+static int skipped(sosc_state_t *state)
+{
+	if (FRAMED(state))
+		state->stats.leds_coalesced++;
+	else
+		state->stats.leds_dropped++;
 
-	return monome_led_map(monome, argv[0]->i, argv[1]->i, buf);
+	return 0;
 }
 
-OSC_HANDLER_FUNC(led_col_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
-	int i;
+static int shadow_lost(sosc_state_t *state)
+{
+	sosc_shadow_init(&state->shadow, state->shadow.cols, state->shadow.rows);
+	return 1;
+}
 
-	if (argc < 3 || argc > 34)
-		return 1;
+static int filter_cell(sosc_state_t *state, int x, int y, int level)
+{
+	if (FRAMED(state)) {
+		sosc_frame_set(state, x, y, level);
+		return 0;
+	}
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1; /* only integers are invited to this party */
+	return sosc_shadow_update(&state->shadow, x, y, level);
+}
 
-	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+static int filter_fill(sosc_state_t *state, int level)
+{
+	if (FRAMED(state)) {
+		sosc_frame_fill(state, level);
+		return 0;
+	}
 
-	return monome_led_col(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	return sosc_shadow_fill(&state->shadow, level);
 }
 
-OSC_HANDLER_FUNC(led_row_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
-	int i;
+/* `count` LEDs (or `count` bytes of on/off bits, if `bits` is set)
+   starting at (x, y) and stepping by (dx, dy). */
+static int filter_line(sosc_state_t *state, int x, int y, int dx, int dy,
+                       size_t count, const uint8_t *data, int bits)
+{
+	int i, n, level, changed = 0;
 
-	if (argc < 3 || argc > 34)
-		return 1;
+	n = (bits) ? count * 8 : count;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1;
+	for (i = 0; i < n; i++) {
+		if (bits)
+			level = ON_LEVEL(data[i / 8] & (1 << (i % 8)));
+		else
+			level = data[i];
 
-	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		changed |= filter_cell(state, x + (i * dx), y + (i * dy), level);
+	}
 
-	return monome_led_row(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	return changed;
 }
 
-OSC_HANDLER_FUNC(led_intensity_handler) {
-	monome_t *monome = user_data;
-	return monome_led_intensity(monome, argv[0]->i);
+static int filter_row(sosc_state_t *state, int x_off, int y,
+                      size_t count, const uint8_t *data, int bits)
+{
+	if (!FRAMED(state) && !QUAD_ALIGNED(x_off))
+		return shadow_lost(state);
+
+	return filter_line(state, x_off, y, 1, 0, count, data, bits);
 }
 
-OSC_HANDLER_FUNC(led_level_set_handler) {
-	monome_t *monome = user_data;
-	return monome_led_level_set(monome, argv[0]->i, argv[1]->i, argv[2]->i);
+static int filter_col(sosc_state_t *state, int x, int y_off,
+                      size_t count, const uint8_t *data, int bits)
+{
+	if (!FRAMED(state) && !QUAD_ALIGNED(y_off))
+		return shadow_lost(state);
+
+	return filter_line(state, x, y_off, 0, 1, count, data, bits);
 }
 
-OSC_HANDLER_FUNC(led_level_all_handler) {
-	monome_t *monome = user_data;
-	return monome_led_level_all(monome, argv[0]->i);
+static int filter_map(sosc_state_t *state, int x_off, int y_off,
+                      const uint8_t *data, int bits)
+{
+	int y, changed = 0;
+
+	if (!FRAMED(state) && (!QUAD_ALIGNED(x_off) || !QUAD_ALIGNED(y_off)))
+		return shadow_lost(state);
+
+	for (y = 0; y < 8; y++) {
+		if (bits)
+			changed |= filter_line(state, x_off, y_off + y, 1, 0,
+			                       1, &data[y], 1);
+		else
+			changed |= filter_line(state, x_off, y_off + y, 1, 0,
+			                       8, &data[y * 8], 0);
+	}
+
+	return changed;
 }
 
-OSC_HANDLER_FUNC(led_level_map_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[64];
+/**
+ * grid
+ */
+
+MEXT_FUNC(led_set) {
+	int on = !!argv[2];
+
+	if (!filter_cell(state, argv[0], argv[1], ON_LEVEL(on)))
+		return skipped(state);
+
+	return written(state, monome_led_set(state->monome, argv[0], argv[1], on));
+}
+
+MEXT_FUNC(led_all) {
+	int on = !!argv[0];
+
+	if (!filter_fill(state, ON_LEVEL(on)))
+		return skipped(state);
+
+	return written(state, monome_led_all(state->monome, on));
+}
+
+MEXT_FUNC(led_map) {
+	uint8_t buf[8];
 	int i;
 
-	for( i = 0; i < 64; i++ )
-		buf[i] = argv[i + (argc - 64)]->i;
+	for( i = 0; i < 8; i++ )
+		buf[i] = argv[i + (argc - 8)];
+
+	if (!filter_map(state, argv[0], argv[1], buf, 1))
+		return skipped(state);
 
-	return monome_led_level_map(monome, argv[0]->i, argv[1]->i, buf);
+	return written(state, monome_led_map(state->monome, argv[0], argv[1], buf));
 }
 
-OSC_HANDLER_FUNC(led_level_col_handler) {
-	monome_t *monome = user_data;
+MEXT_FUNC(led_col) {
 	uint8_t buf[32];
 	int i;
 
 	if (argc < 3 || argc > 34)
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1; /* only integers are invited to this party */
-
 	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		buf[i] = argv[i + 2];
 
-	return monome_led_level_col(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	if (!filter_col(state, argv[0], argv[1], argc - 2, buf, 1))
+		return skipped(state);
+
+	return written(state,
+		monome_led_col(state->monome, argv[0], argv[1], argc - 2, buf));
 }
 
-OSC_HANDLER_FUNC(led_level_row_handler) {
-	monome_t *monome = user_data;
+MEXT_FUNC(led_row) {
 	uint8_t buf[32];
 	int i;
 
 	if (argc < 3 || argc > 34)
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1;
-
 	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		buf[i] = argv[i + 2];
 
-	return monome_led_level_row(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	if (!filter_row(state, argv[0], argv[1], argc - 2, buf, 1))
+		return skipped(state);
+
+	return written(state,
+		monome_led_row(state->monome, argv[0], argv[1], argc - 2, buf));
+}
+
+MEXT_FUNC(led_intensity) {
+	return written(state, monome_led_intensity(state->monome, argv[0]));
 }
 
-OSC_HANDLER_FUNC(led_ring_set_handler) {
-	monome_t *monome = user_data;
+MEXT_FUNC(led_level_set) {
+	if (!filter_cell(state, argv[0], argv[1], argv[2]))
+		return skipped(state);
 
-	return monome_led_ring_set(monome, argv[0]->i, argv[1]->i, argv[2]->i);
+	return written(state,
+		monome_led_level_set(state->monome, argv[0], argv[1], argv[2]));
 }
 
-OSC_HANDLER_FUNC(led_ring_all_handler) {
-	monome_t *monome = user_data;
+MEXT_FUNC(led_level_all) {
+	if (!filter_fill(state, argv[0]))
+		return skipped(state);
 
-	return monome_led_ring_all(monome, argv[0]->i, argv[1]->i);
+	return written(state, monome_led_level_all(state->monome, argv[0]));
 }
 
-OSC_HANDLER_FUNC(led_ring_map_handler) {
-	monome_t *monome = user_data;
+MEXT_FUNC(led_level_map) {
 	uint8_t buf[64];
 	int i;
 
 	for( i = 0; i < 64; i++ )
-		buf[i] = argv[i + (argc - 64)]->i;
-
-	return monome_led_ring_map(monome, argv[0]->i, buf);
-}
+		buf[i] = argv[i + (argc - 64)];
 
-OSC_HANDLER_FUNC(led_ring_range_handler) {
-	monome_t *monome = user_data;
+	if (!filter_map(state, argv[0], argv[1], buf, 0))
+		return skipped(state);
 
-	return monome_led_ring_range(monome, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i);
+	return written(state,
+		monome_led_level_map(state->monome, argv[0], argv[1], buf));
 }
 
-OSC_HANDLER_FUNC(tilt_set_handler) {
-	monome_t *monome = user_data;
-
-	if( argv[1]->i )
-		return monome_tilt_enable(monome, argv[0]->i);
-	else
-		return monome_tilt_disable(monome, argv[0]->i);
-}
-
-#define METHOD(path) for( cmd_buf = osc_path(path, prefix); cmd_buf; \
-                          s_free(cmd_buf), cmd_buf = NULL )
-
-void osc_register_methods(sosc_state_t *state) {
-	char *prefix, *cmd_buf;
-	monome_t *monome;
-	lo_server srv;
-
-	prefix = state->config.app.osc_prefix;
-	monome = state->monome;
-	srv = state->server;
-
-#define REGISTER(typetags, cb) \
-	lo_server_add_method(srv, cmd_buf, typetags, cb, monome)
-
-	METHOD("grid/led/set")
-		REGISTER("iii", led_set_handler);
-
-	METHOD("grid/led/all")
-		REGISTER("i", led_all_handler);
+MEXT_FUNC(led_level_col) {
+	uint8_t buf[32];
+	int i;
 
-	METHOD("grid/led/map")
-		REGISTER("iiiiiiiiii", led_map_handler);
+	if (argc < 3 || argc > 34)
+		return 1;
 
-	METHOD("grid/led/col")
-		REGISTER(NULL, led_col_handler);
+	for (i = 0; i < (argc - 2); i++)
+		buf[i] = argv[i + 2];
 
-	METHOD("grid/led/row")
-		REGISTER(NULL, led_row_handler);
+	if (!filter_col(state, argv[0], argv[1], argc - 2, buf, 0))
+		return skipped(state);
 
-	METHOD("grid/led/intensity")
-		REGISTER("i", led_intensity_handler);
+	return written(state,
+		monome_led_level_col(state->monome, argv[0], argv[1], argc - 2, buf));
+}
 
-	METHOD("grid/led/level/set")
-		REGISTER("iii", led_level_set_handler);
+MEXT_FUNC(led_level_row) {
+	uint8_t buf[32];
+	int i;
 
-	METHOD("grid/led/level/all")
-		REGISTER("i", led_level_all_handler);
+	if (argc < 3 || argc > 34)
+		return 1;
 
-	METHOD("grid/led/level/map")
-		REGISTER("ii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii",
-		         led_level_map_handler);
+	for (i = 0; i < (argc - 2); i++)
+		buf[i] = argv[i + 2];
 
-	METHOD("grid/led/level/col")
-		REGISTER(NULL, led_level_col_handler);
+	if (!filter_row(state, argv[0], argv[1], argc - 2, buf, 0))
+		return skipped(state);
 
-	METHOD("grid/led/level/row")
-		REGISTER(NULL, led_level_row_handler);
+	return written(state,
+		monome_led_level_row(state->monome, argv[0], argv[1], argc - 2, buf));
+}
 
-	METHOD("ring/set")
-		REGISTER("iii", led_ring_set_handler);
+/* the whole grid at once, as a blob of levels in row-major order. levels
+   are either one per byte, or packed two to a byte with the leftmost LED
+   of each pair in the high nibble. which one is inferred from the blob's
+   size. */
 
-	METHOD("ring/all")
-		REGISTER("ii", led_ring_all_handler);
+OSC_HANDLER_FUNC(led_level_frame_handler) {
+	sosc_state_t *state = user_data;
+	lo_blob blob = (lo_blob) argv[0];
+	int cols, rows, packed, x_off, y_off, x, y, i;
+	const uint8_t *levels;
+	uint8_t buf[64];
+	size_t cells;
 
-	METHOD("ring/map")
-		REGISTER("i"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii",
-		         led_ring_map_handler);
+	cols = monome_get_cols(state->monome);
+	rows = monome_get_rows(state->monome);
+	cells = cols * rows;
 
-	METHOD("ring/range")
-		REGISTER("iiii", led_ring_range_handler);
+	if (lo_blob_datasize(blob) == cells)
+		packed = 0;
+	else if (lo_blob_datasize(blob) == (cells + 1) / 2)
+		packed = 1;
+	else
+		return 1;
 
-	METHOD("tilt/set")
-		REGISTER("ii", tilt_set_handler);
+	levels = lo_blob_dataptr(blob);
+
+	for (y_off = 0; y_off < rows; y_off += 8) {
+		for (x_off = 0; x_off < cols; x_off += 8) {
+			for (y = 0; y < 8; y++) {
+				for (x = 0; x < 8; x++) {
+					if ((x_off + x) >= cols || (y_off + y) >= rows) {
+						buf[(y * 8) + x] = 0;
+						continue;
+					}
+
+					i = ((y_off + y) * cols) + x_off + x;
+
+					if (packed)
+						buf[(y * 8) + x] =
+							(levels[i / 2] >> ((i & 1) ? 0 : 4)) & 0xF;
+					else
+						buf[(y * 8) + x] = levels[i];
+				}
+			}
+
+			if (filter_map(state, x_off, y_off, buf, 0))
+				written(state, monome_led_level_map(state->monome,
+				                                    x_off, y_off, buf));
+			else
+				skipped(state);
+		}
+	}
 
-#undef REGISTER
+	return 0;
 }
 
-void osc_unregister_methods(sosc_state_t *state) {
-	char *prefix, *cmd_buf;
-	lo_server srv;
+/**
+ * arc
+ */
 
-	prefix = state->config.app.osc_prefix;
-	srv = state->server;
+MEXT_FUNC(led_ring_set) {
+	return written(state,
+		monome_led_ring_set(state->monome, argv[0], argv[1], argv[2]));
+}
 
-#define UNREGISTER(typetags) \
-	lo_server_del_method(srv, cmd_buf, typetags)
+MEXT_FUNC(led_ring_all) {
+	return written(state, monome_led_ring_all(state->monome, argv[0], argv[1]));
+}
 
-	METHOD("grid/led/set")
-		UNREGISTER("iii");
+MEXT_FUNC(led_ring_map) {
+	uint8_t buf[64];
+	int i;
 
-	METHOD("grid/led/all")
-		UNREGISTER("i");
+	for( i = 0; i < 64; i++ )
+		buf[i] = argv[i + (argc - 64)];
 
-	METHOD("grid/led/map")
-		UNREGISTER("iiiiiiiiii");
+	return written(state, monome_led_ring_map(state->monome, argv[0], buf));
+}
 
-	METHOD("grid/led/col")
-		UNREGISTER(NULL);
+MEXT_FUNC(led_ring_range) {
+	return written(state,
+		monome_led_ring_range(state->monome, argv[0], argv[1],
+		                      argv[2], argv[3]));
+}
 
-	METHOD("grid/led/row")
-		UNREGISTER(NULL);
+/**
+ * tilt
+ */
 
-	METHOD("grid/led/intensity")
-		UNREGISTER("i");
+MEXT_FUNC(tilt_set) {
+	if( argv[1] )
+		return written(state, monome_tilt_enable(state->monome, argv[0]));
+	else
+		return written(state, monome_tilt_disable(state->monome, argv[0]));
+}
 
-	METHOD("grid/led/level/set")
-		UNREGISTER("iii");
+/**
+ * registration
+ */
 
-	METHOD("grid/led/level/all")
-		UNREGISTER("i");
+#define MAP_TYPES \
+	"iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii" \
+	"iiiiiiii" "iiiiiiii" "iiiiiiii" "iiiiiiii"
+
+const sosc_osc_method_t osc_mext_methods[] = {
+	{"grid/led/set",         "iii",          led_set,         led_set_handler},
+	{"grid/led/all",         "i",            led_all,         led_all_handler},
+	{"grid/led/map",         "iiiiiiiiii",   led_map,         led_map_handler},
+	{"grid/led/col",         NULL,           led_col,         led_col_handler},
+	{"grid/led/row",         NULL,           led_row,         led_row_handler},
+	{"grid/led/intensity",   "i",            led_intensity,   led_intensity_handler},
+	{"grid/led/level/set",   "iii",          led_level_set,   led_level_set_handler},
+	{"grid/led/level/all",   "i",            led_level_all,   led_level_all_handler},
+	{"grid/led/level/map",   "ii" MAP_TYPES, led_level_map,   led_level_map_handler},
+	{"grid/led/level/col",   NULL,           led_level_col,   led_level_col_handler},
+	{"grid/led/level/row",   NULL,           led_level_row,   led_level_row_handler},
+	{"grid/led/level/frame", "b",            NULL,            led_level_frame_handler},
+	{"ring/set",             "iii",          led_ring_set,    led_ring_set_handler},
+	{"ring/all",             "ii",           led_ring_all,    led_ring_all_handler},
+	{"ring/map",             "i" MAP_TYPES,  led_ring_map,    led_ring_map_handler},
+	{"ring/range",           "iiii",         led_ring_range,  led_ring_range_handler},
+	{"tilt/set",             "ii",           tilt_set,        tilt_set_handler},
+	{NULL}
+};
+
+#undef MAP_TYPES
+
+/* liblo only sees the mext methods for messages which didn't come
+   through osc_dispatch(), i.e. ones in bundles, with non-numeric
+   arguments or with address patterns. rather than registering each
+   method under the current prefix, we register a single catch-all which
+   does the same lookup, so that changing the prefix doesn't involve
+   liblo at all. */
+
+static int call_method(const sosc_osc_method_t *m, sosc_state_t *state,
+                       const char *path, const char *types, lo_arg **argv,
+                       int argc, lo_message data) {
+	state->stats.mext_calls[m - osc_mext_methods]++;
+
+	/* the typespec has to be checked here, since liblo won't. numeric
+	   arguments get coerced by the handler. */
+	if (m->typespec) {
+		if (m->func && argc != strlen(m->typespec))
+			return 1;
+		else if (!m->func && strcmp(types, m->typespec))
+			return 1;
+	}
 
-	METHOD("grid/led/level/map")
-		UNREGISTER("ii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii");
+	if (m->handler(path, types, argv, argc, data, state))
+		return 1;
 
-	METHOD("grid/led/level/col")
-		UNREGISTER(NULL);
+	state->stats.mext_handled++;
+	return 0;
+}
 
-	METHOD("grid/led/level/row")
-		UNREGISTER(NULL);
+/* an address pattern (i.e. /monome/grid/led/{set,row}) goes to every
+   method it matches, just as it would if liblo were doing the matching. */
+static int call_matching_methods(sosc_state_t *state, const char *path,
+                                 const char *types, lo_arg **argv, int argc,
+                                 lo_message data) {
+	const sosc_osc_method_t *m;
+	char full[256];
+	int ret = 1;
+
+	for (m = osc_mext_methods; m->path; m++) {
+		if (snprintf(full, sizeof(full), "%s/%s",
+		             state->dispatch.prefix.str, m->path) >= sizeof(full))
+			continue;
+
+		if (lo_pattern_match(full, path)
+		    && !call_method(m, state, path, types, argv, argc, data))
+			ret = 0;
+	}
+
+	return ret;
+}
 
-	METHOD("ring/set")
-		UNREGISTER("iii");
+OSC_HANDLER_FUNC(mext_handler) {
+	const sosc_osc_method_t *m;
+	sosc_state_t *state = user_data;
 
-	METHOD("ring/all")
-		UNREGISTER("ii");
+	if (strpbrk(path, "*?[]{}"))
+		return call_matching_methods(state, path, types, argv, argc, data);
 
-	METHOD("ring/map")
-		UNREGISTER("i"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii");
+	if (!(m = osc_dispatch_lookup(state, path)))
+		return 1;
 
-	METHOD("ring/range")
-		UNREGISTER("iiii");
+	return call_method(m, state, path, types, argv, argc, data);
+}
 
-	METHOD("tilt/set")
-		UNREGISTER("ii");
+/* should be called after osc_register_sys_methods(), since liblo tries
+   the catch-all against everything. */
+void osc_register_methods(sosc_state_t *state) {
+	osc_dispatch_build(state);
+	osc_dispatch_set_prefix(state, state->config.app.osc_prefix);
 
-#undef UNREGISTER
+	lo_server_add_method(state->server, NULL, NULL, mext_handler, state);
 }
-
-#undef METHOD
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config-autogen.h"
+
+#ifdef HAVE_SENDMMSG
+#define _GNU_SOURCE /* for sendmmsg() */
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/* a send queue collects the messages from something which sends several
+   at once (an info reply, a device list, a notification fan-out) and
+   hands them to the kernel together with sendmmsg(). where that isn't
+   available, flushing falls back to one sendto() per message.
+
+   messages are serialised and their destinations resolved as they're
+   added, so the caller is free to release both straight away. */
+
+void osc_sendq_init(sosc_sendq_t *q, int fd)
+{
+	q->fd = fd;
+	q->count = 0;
+	q->used = 0;
+	q->last.len = 0;
+	q->sent = 0;
+}
+
+static int resolve(sosc_sendq_t *q, const char *host, const char *port)
+{
+	if (q->last.len
+	    && !strcmp(q->last.host, host) && !strcmp(q->last.port, port))
+		return 0;
+
+	q->last.len = 0;
+
+	if (strlen(host) >= sizeof(q->last.host)
+	    || strlen(port) >= sizeof(q->last.port))
+		return -1;
+
+	if (osc_resolve(q->fd, host, port, &q->last.addr, &q->last.len)) {
+		q->last.len = 0;
+		return -1;
+	}
+
+	strcpy(q->last.host, host);
+	strcpy(q->last.port, port);
+	return 0;
+}
+
+/* for destinations which have already been resolved with osc_resolve() */
+int osc_sendq_add_addr(sosc_sendq_t *q, const struct sockaddr_storage *addr,
+                       socklen_t addrlen, const char *path, lo_message msg)
+{
+	size_t len;
+
+	if (!msg)
+		return -1;
+
+	len = lo_message_length(msg, path);
+
+	if (len > sizeof(q->buf)) {
+		fprintf(stderr, "osc_sendq_add(): %s too long to send\n", path);
+		return -1;
+	}
+
+	if (q->count == SOSC_SENDQ_LEN || q->used + len > sizeof(q->buf))
+		osc_sendq_flush(q);
+
+	lo_message_serialise(msg, path, q->buf + q->used, &len);
+
+	memcpy(&q->msgs[q->count].addr, addr, addrlen);
+	q->msgs[q->count].addrlen = addrlen;
+	q->msgs[q->count].off = q->used;
+	q->msgs[q->count].len = len;
+
+	q->used += len;
+	q->count++;
+
+	return 0;
+}
+
+int osc_sendq_add(sosc_sendq_t *q, const char *host, const char *port,
+                  const char *path, lo_message msg)
+{
+	if (!msg)
+		return -1;
+
+	if (resolve(q, host, port)) {
+		fprintf(stderr, "osc_sendq_add(): couldn't resolve %s:%s\n",
+		        host, port);
+		return -1;
+	}
+
+	return osc_sendq_add_addr(q, &q->last.addr, q->last.len, path, msg);
+}
+
+#ifdef HAVE_SENDMMSG
+static int send_all(sosc_sendq_t *q)
+{
+	struct mmsghdr msgs[SOSC_SENDQ_LEN];
+	struct iovec iovs[SOSC_SENDQ_LEN];
+	int i, sent, n, ret = 0;
+
+	for (i = 0; i < q->count; i++) {
+		iovs[i].iov_base = q->buf + q->msgs[i].off;
+		iovs[i].iov_len  = q->msgs[i].len;
+
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name    = &q->msgs[i].addr;
+		msgs[i].msg_hdr.msg_namelen = q->msgs[i].addrlen;
+		msgs[i].msg_hdr.msg_iov     = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen  = 1;
+	}
+
+	/* sendmmsg() stops at the first message which fails, so skip over
+	   that one and carry on with the rest, just as a series of
+	   sendto()s would. */
+	for (sent = 0; sent < q->count; sent += n) {
+		n = sendmmsg(q->fd, msgs + sent, q->count - sent, 0);
+
+		if (n <= 0) {
+			ret = -1;
+			n = 1;
+		} else
+			q->sent += n;
+	}
+
+	return ret;
+}
+#else
+static int send_all(sosc_sendq_t *q)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < q->count; i++)
+		if (sendto(q->fd, (const void *) (q->buf + q->msgs[i].off),
+		           q->msgs[i].len, 0,
+		           (struct sockaddr *) &q->msgs[i].addr,
+		           q->msgs[i].addrlen) < 0)
+			ret = -1;
+		else
+			q->sent++;
+
+	return ret;
+}
+#endif
+
+int osc_sendq_flush(sosc_sendq_t *q)
+{
+	int ret;
+
+	if (!q->count)
+		return 0;
+
+	ret = send_all(q);
+
+	q->count = 0;
+	q->used = 0;
+	q->last.len = 0;
+
+	return ret;
+}
@@ -34,8 +34,20 @@ static int portstr(char *dest, int src) {
 
 /**
  * /sys/info business
+ *
+ * replies are queued on state->sendq and flushed once the handler is
+ * done, so that a full /sys/info goes out in a single syscall.
  */
 
+static void info_reply(lo_address *to, sosc_state_t *state,
+                       const char *path, lo_message msg) {
+	osc_sendq_add(&state->sendq, lo_address_get_hostname(to),
+	              lo_address_get_port(to), path, msg);
+
+	if( msg )
+		lo_message_free(msg);
+}
+
 typedef void (info_reply_func_t)(lo_address *, sosc_state_t *);
 
 static int info_prop_handler(lo_arg **argv, int argc, void *user_data,
@@ -60,19 +72,24 @@ static int info_prop_handler(lo_arg **argv, int argc, void *user_data,
 	cb(dst, state);
 	lo_address_free(dst);
 
+	osc_sendq_flush(&state->sendq);
+
 	return 0;
 }
 
 static int info_prop_handler_default(void *user_data, info_reply_func_t cb) {
 	sosc_state_t *state = user_data;
 	cb(state->outgoing, state);
+	osc_sendq_flush(&state->sendq);
 	return 0;
 }
 
 #define DECLARE_INFO_REPLY_FUNC(prop, typetag, ...)\
 	static void info_reply_##prop(lo_address *to, sosc_state_t *state) {\
-		lo_send_from(to, state->server, LO_TT_IMMEDIATE, "/sys/" #prop,\
-					 typetag, __VA_ARGS__);\
+		lo_message msg = lo_message_new();\
+		if( msg )\
+			lo_message_add(msg, typetag, __VA_ARGS__);\
+		info_reply(to, state, "/sys/" #prop, msg);\
 	}
 
 #define DECLARE_INFO_HANDLERS(prop)\
@@ -95,11 +112,15 @@ DECLARE_INFO_PROP(port, "i", atoi(lo_address_get_port(state->outgoing)))
 DECLARE_INFO_PROP(prefix, "s", state->config.app.osc_prefix)
 
 static void info_reply_rotation(lo_address *to, sosc_state_t *state) {
+	lo_message msg;
+
 	if( monome_get_cols(state->monome) != monome_get_rows(state->monome) )
 		info_reply_size(to, state);
 
-	lo_send_from(to, state->server, LO_TT_IMMEDIATE, "/sys/rotation", "i",
-	             monome_get_rotation(state->monome) * 90);
+	if( (msg = lo_message_new()) )
+		lo_message_add_int32(msg, monome_get_rotation(state->monome) * 90);
+
+	info_reply(to, state, "/sys/rotation", msg);
 }
 
 DECLARE_INFO_HANDLERS(rotation);
@@ -121,6 +142,100 @@ OSC_HANDLER_FUNC(sys_info_handler_default) {
 	return info_prop_handler_default(user_data, info_reply_all);
 }
 
+/**
+ * /sys/stats
+ *
+ * the counters in state->stats, as a burst of /sys/stats/... replies.
+ * they're all int64s, since an int32 would overflow on a busy device
+ * within a few days.
+ */
+
+static void stats_reply(lo_address *to, sosc_state_t *state,
+                        const char *path, int count, const uint64_t *vals) {
+	lo_message msg;
+	int i;
+
+	if( (msg = lo_message_new()) )
+		for( i = 0; i < count; i++ )
+			lo_message_add_int64(msg, vals[i]);
+
+	info_reply(to, state, path, msg);
+}
+
+static void info_reply_stats(lo_address *to, sosc_state_t *state) {
+	const sosc_stats_t *s = &state->stats;
+	const sosc_osc_method_t *m;
+	lo_message msg;
+	uint64_t v[2];
+
+	/* key, enc delta, enc key, tilt */
+	stats_reply(to, state, "/sys/stats/input", SOSC_INPUT_MAX, s->input);
+
+	v[0] = s->datagrams_in;
+	v[1] = s->datagrams_out + state->sendq.sent;
+	stats_reply(to, state, "/sys/stats/datagrams", 2, v);
+
+	/* one for each mext method: its path below the prefix, and calls */
+	for( m = osc_mext_methods; m->path; m++ ) {
+		if( !(msg = lo_message_new()) )
+			continue;
+
+		lo_message_add_string(msg, m->path);
+		lo_message_add_int64(msg, s->mext_calls[m - osc_mext_methods]);
+		info_reply(to, state, "/sys/stats/method", msg);
+	}
+
+	stats_reply(to, state, "/sys/stats/handled", 1, &s->mext_handled);
+	stats_reply(to, state, "/sys/stats/serial", 1, &s->serial_bytes);
+	stats_reply(to, state, "/sys/stats/wakeups", 1, &s->wakeups);
+
+	/* average and max nanoseconds per incoming datagram */
+	v[0] = (s->datagrams_in) ? s->handler_ns_total / s->datagrams_in : 0;
+	v[1] = s->handler_ns_max;
+	stats_reply(to, state, "/sys/stats/handler", 2, v);
+
+	v[0] = s->leds_dropped;
+	v[1] = s->leds_coalesced;
+	stats_reply(to, state, "/sys/stats/leds", 2, v);
+}
+
+OSC_HANDLER_FUNC(sys_stats_handler) {
+	return info_prop_handler(argv, argc, user_data, info_reply_stats);
+}
+
+OSC_HANDLER_FUNC(sys_stats_handler_default) {
+	return info_prop_handler_default(user_data, info_reply_stats);
+}
+
+/**
+ * /sys/latency
+ *
+ * the histograms in state->latency, each summed up as its count and its
+ * p50, p90, p99, p99.9 and max in nanoseconds. see src/latency.c
+ */
+
+static void latency_reply(lo_address *to, sosc_state_t *state,
+                          const char *path, const sosc_histogram_t *h) {
+	uint64_t v[SOSC_HIST_SUMMARY];
+
+	sosc_histogram_summary(h, v);
+	stats_reply(to, state, path, SOSC_HIST_SUMMARY, v);
+}
+
+static void info_reply_latency(lo_address *to, sosc_state_t *state) {
+	latency_reply(to, state, "/sys/latency/input", &state->latency.input);
+	latency_reply(to, state, "/sys/latency/output", &state->latency.output);
+	latency_reply(to, state, "/sys/latency/jitter", &state->latency.jitter);
+}
+
+OSC_HANDLER_FUNC(sys_latency_handler) {
+	return info_prop_handler(argv, argc, user_data, info_reply_latency);
+}
+
+OSC_HANDLER_FUNC(sys_latency_handler_default) {
+	return info_prop_handler_default(user_data, info_reply_latency);
+}
+
 /**/
  
 
@@ -163,7 +278,12 @@ OSC_HANDLER_FUNC(sys_cable_legacy_handler) {
 		return 0;
 
 	monome_set_rotation(state->monome, new);
+	sosc_shadow_init(&state->shadow, monome_get_cols(state->monome),
+	                 monome_get_rows(state->monome));
+	sosc_frame_redraw(state);
+
 	info_reply_rotation(state->outgoing, state);
+	osc_sendq_flush(&state->sendq);
 	return 0;
 }
 
@@ -178,7 +298,12 @@ OSC_HANDLER_FUNC(sys_rotation_handler) {
 		return 0;
 
 	monome_set_rotation(state->monome, new);
+	sosc_shadow_init(&state->shadow, monome_get_cols(state->monome),
+	                 monome_get_rows(state->monome));
+	sosc_frame_redraw(state);
+
 	info_reply_rotation(state->outgoing, state);
+	osc_sendq_flush(&state->sendq);
 	return 0;
 }
 
@@ -195,9 +320,11 @@ OSC_HANDLER_FUNC(sys_port_handler) {
 	}
 
 	state->outgoing = new;
+	osc_resolve_outgoing(state);
 
 	info_reply_port(old, state);
 	info_reply_port(new, state);
+	osc_sendq_flush(&state->sendq);
 
 	lo_address_free(old);
 
@@ -214,9 +341,11 @@ OSC_HANDLER_FUNC(sys_host_handler) {
 	}
 
 	state->outgoing = new;
+	osc_resolve_outgoing(state);
 
 	info_reply_host(old, state);
 	info_reply_host(new, state);
+	osc_sendq_flush(&state->sendq);
 
 	lo_address_free(old);
 
@@ -233,11 +362,11 @@ OSC_HANDLER_FUNC(sys_prefix_handler) {
 	else
 		new = s_strdup(&argv[0]->s);
 
-	osc_unregister_methods(state);
-	state->config.app.osc_prefix = new;
-	osc_register_methods(state);
+	osc_dispatch_set_prefix(state, new);
+	osc_build_event_templates(state);
 
 	info_reply_prefix(state->outgoing, state);
+	osc_sendq_flush(&state->sendq);
 
 	s_free(old);
 
@@ -270,6 +399,18 @@ void osc_register_sys_methods(sosc_state_t *state) {
 		REGISTER("", sys_info_handler_default, state);
 	}
 
+	METHOD("stats") {
+		REGISTER("si", sys_stats_handler, state);
+		REGISTER("i", sys_stats_handler, state);
+		REGISTER("", sys_stats_handler_default, state);
+	}
+
+	METHOD("latency") {
+		REGISTER("si", sys_latency_handler, state);
+		REGISTER("i", sys_latency_handler, state);
+		REGISTER("", sys_latency_handler_default, state);
+	}
+
 	METHOD("cable")
 		REGISTER("s", sys_cable_legacy_handler, state);
 
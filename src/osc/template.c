@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/* OSC strings are null-terminated and padded out to a multiple of 4 */
+#define OSC_STRLEN(len) (((len) + 4) & ~3)
+
+/*************************************************************************
+ * templates
+ *************************************************************************/
+
+int osc_template_init(sosc_osc_template_t *t, const char *path, int argc)
+{
+	size_t pathlen, typelen;
+	uint8_t *types;
+
+	pathlen = OSC_STRLEN(strlen(path));
+	typelen = OSC_STRLEN(argc + 1);
+
+	t->len = pathlen + typelen + (argc * sizeof(int32_t));
+
+	if (!(t->data = s_calloc(t->len, sizeof(uint8_t))))
+		return -1;
+
+	memcpy(t->data, path, strlen(path));
+
+	types = t->data + pathlen;
+	types[0] = ',';
+	memset(types + 1, 'i', argc);
+
+	t->args = types + typelen;
+	t->argc = argc;
+
+	return 0;
+}
+
+void osc_template_free(sosc_osc_template_t *t)
+{
+	s_free(t->data);
+	memset(t, 0, sizeof(*t));
+}
+
+void osc_template_set_int(sosc_osc_template_t *t, int idx, int32_t val)
+{
+	uint32_t be = htonl((uint32_t) val);
+	memcpy(t->args + (idx * sizeof(be)), &be, sizeof(be));
+}
+
+int osc_template_send(sosc_state_t *state, sosc_osc_template_t *t)
+{
+	if (state->config.app.bundle.enabled)
+		return osc_bundle_add(state, t->data, t->len);
+
+	return osc_send_raw(state, t->data, t->len);
+}
+
+int osc_send_raw(sosc_state_t *state, const uint8_t *buf, size_t len)
+{
+	/* the host didn't resolve. rather than trying again for every event,
+	   we leave it to osc_resolve_service(). */
+	if (!state->outgoing_addr.len)
+		return -1;
+
+	if (sendto(lo_server_get_socket_fd(state->server),
+	           (const void *) buf, len, 0,
+	           (struct sockaddr *) &state->outgoing_addr.addr,
+	           state->outgoing_addr.len) < 0)
+		return -1;
+
+	state->stats.datagrams_out++;
+	return 0;
+}
+
+/*************************************************************************
+ * bundling
+ *************************************************************************/
+
+/* "#bundle\0", then a 64-bit timetag */
+#define BUNDLE_HEADER_SIZE 16
+
+static void bundle_start(sosc_state_t *state)
+{
+	uint32_t be;
+	lo_timetag tt;
+
+	lo_timetag_now(&tt);
+
+	memcpy(state->bundle.buf, "#bundle", 8);
+
+	be = htonl(tt.sec);
+	memcpy(state->bundle.buf + 8, &be, sizeof(be));
+	be = htonl(tt.frac);
+	memcpy(state->bundle.buf + 12, &be, sizeof(be));
+
+	state->bundle.len = BUNDLE_HEADER_SIZE;
+	state->bundle.deadline =
+		sosc_monotonic_us() + state->config.app.bundle.window;
+}
+
+int osc_bundle_add(sosc_state_t *state, const uint8_t *msg, size_t len)
+{
+	uint32_t be;
+
+	/* too big to ever fit in a bundle, so it'll have to go on its own.
+	   flush first so that events still go out in order. */
+	if (len + sizeof(be) > sizeof(state->bundle.buf) - BUNDLE_HEADER_SIZE) {
+		osc_bundle_flush(state);
+		return osc_send_raw(state, msg, len);
+	}
+
+	if (state->bundle.len + sizeof(be) + len > sizeof(state->bundle.buf))
+		osc_bundle_flush(state);
+
+	if (!state->bundle.len)
+		bundle_start(state);
+
+	be = htonl(len);
+	memcpy(state->bundle.buf + state->bundle.len, &be, sizeof(be));
+	memcpy(state->bundle.buf + state->bundle.len + sizeof(be), msg, len);
+	state->bundle.len += sizeof(be) + len;
+
+	return 0;
+}
+
+int osc_bundle_flush(sosc_state_t *state)
+{
+	int ret;
+
+	if (!state->bundle.len)
+		return 0;
+
+	ret = osc_send_raw(state, state->bundle.buf, state->bundle.len);
+	state->bundle.len = 0;
+
+	return ret;
+}
+
+/* when the pending bundle is due to go out (in sosc_monotonic_us() time),
+   or 0 if there's nothing pending. */
+uint64_t osc_bundle_deadline(const sosc_state_t *state)
+{
+	if (!state->bundle.len)
+		return 0;
+
+	return state->bundle.deadline;
+}
+
+/* called by the event loops once per wakeup, after the serial port has
+   been read from. with a bundle window of 0, the deadline has always
+   passed by then. */
+void osc_bundle_service(sosc_state_t *state)
+{
+	if (state->bundle.len && sosc_monotonic_us() >= state->bundle.deadline)
+		osc_bundle_flush(state);
+}
+
+/*************************************************************************
+ * address resolution
+ *************************************************************************/
+
+/* resolves host:port to an address which can be sent to from fd. */
+int osc_resolve(int fd, const char *host, const char *port,
+                struct sockaddr_storage *addr, socklen_t *len)
+{
+	struct sockaddr_storage local;
+	struct addrinfo hints, *ai;
+	socklen_t local_len;
+
+	/* we send from the server's own socket (just like lo_send_from()
+	   does) so we have to resolve to the same family. */
+	local_len = sizeof(local);
+
+	if (getsockname(fd, (struct sockaddr *) &local, &local_len) < 0)
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = local.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+
+#ifdef AI_V4MAPPED
+	/* so that IPv4 hosts still work from a dual-stack socket */
+	if (local.ss_family == AF_INET6)
+		hints.ai_flags = AI_V4MAPPED;
+#endif
+
+	if (getaddrinfo(host, port, &hints, &ai))
+		return -1;
+
+	memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+	*len = ai->ai_addrlen;
+
+	freeaddrinfo(ai);
+	return 0;
+}
+
+static int resolve_outgoing(sosc_state_t *state)
+{
+	state->outgoing_addr.len = 0;
+
+	if (osc_resolve(lo_server_get_socket_fd(state->server),
+	                lo_address_get_hostname(state->outgoing),
+	                lo_address_get_port(state->outgoing),
+	                &state->outgoing_addr.addr, &state->outgoing_addr.len)) {
+		state->outgoing_addr.len = 0;
+		state->outgoing_addr.retry =
+			sosc_monotonic_us() + SOSC_RESOLVE_RETRY_INTERVAL;
+
+		return -1;
+	}
+
+	state->outgoing_addr.retry = 0;
+	return 0;
+}
+
+/* called whenever state->outgoing changes. if the host doesn't resolve
+   (say the network isn't up yet), nothing is sent to the application
+   until it does: osc_resolve_service() tries again every so often. */
+int osc_resolve_outgoing(sosc_state_t *state)
+{
+	if (resolve_outgoing(state)) {
+		fprintf(stderr, "serialosc [%s]: couldn't resolve %s:%s, "
+		        "will keep trying\n",
+		        monome_get_serial(state->monome),
+		        lo_address_get_hostname(state->outgoing),
+		        lo_address_get_port(state->outgoing));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* when to next try resolving the host, or 0 if it's resolved */
+uint64_t osc_resolve_deadline(const sosc_state_t *state)
+{
+	return state->outgoing_addr.retry;
+}
+
+void osc_resolve_service(sosc_state_t *state)
+{
+	if (!state->outgoing_addr.retry
+	    || sosc_monotonic_us() < state->outgoing_addr.retry)
+		return;
+
+	if (!resolve_outgoing(state))
+		fprintf(stderr, "serialosc [%s]: resolved %s:%s\n",
+		        monome_get_serial(state->monome),
+		        lo_address_get_hostname(state->outgoing),
+		        lo_address_get_port(state->outgoing));
+}
@@ -37,3 +37,34 @@ char *osc_path(const char *path, const char *prefix) {
 
 	return buf;
 }
+
+void osc_free_event_templates(sosc_state_t *state) {
+	osc_template_free(&state->templates.grid_key);
+	osc_template_free(&state->templates.enc_delta);
+	osc_template_free(&state->templates.enc_key);
+	osc_template_free(&state->templates.tilt);
+}
+
+void osc_build_event_templates(sosc_state_t *state) {
+	const char *prefix = state->config.app.osc_prefix;
+	char *path;
+
+	osc_free_event_templates(state);
+
+#define TEMPLATE(t, p, argc) do {                                        \
+		path = osc_path(p, prefix);                                      \
+		if( osc_template_init(&state->templates.t, path, argc) ) {       \
+			fprintf(stderr, "aieee, could not allocate memory in "       \
+			        "osc_build_event_templates(), bailing out!\n");      \
+			_exit(EXIT_FAILURE);                                         \
+		}                                                                \
+		s_free(path);                                                    \
+	} while( 0 )
+
+	TEMPLATE(grid_key, "grid/key", 3);
+	TEMPLATE(enc_delta, "enc/delta", 2);
+	TEMPLATE(enc_key, "enc/key", 2);
+	TEMPLATE(tilt, "tilt", 4);
+
+#undef TEMPLATE
+}
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <mach/mach_time.h>
 
 #include "platform.h"
 
@@ -40,3 +41,21 @@ err_mkdir:
 	s_free(cdir);
 	return 1;
 }
+
+uint64_t sosc_monotonic_us() {
+	static mach_timebase_info_data_t tb;
+
+	if( !tb.denom )
+		mach_timebase_info(&tb);
+
+	return (mach_absolute_time() * tb.numer / tb.denom) / 1000;
+}
+
+uint64_t sosc_monotonic_ns() {
+	static mach_timebase_info_data_t tb;
+
+	if( !tb.denom )
+		mach_timebase_info(&tb);
+
+	return mach_absolute_time() * tb.numer / tb.denom;
+}
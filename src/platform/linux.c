@@ -14,10 +14,22 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 
+#include "config-autogen.h"
+
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
 #include "platform.h"
+#include "timer.h"
 
 char *sosc_get_config_directory() {
 	char *dir;
@@ -60,3 +72,48 @@ err_mkdir:
 	s_free(cdir);
 	return 1;
 }
+
+uint64_t sosc_monotonic_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+uint64_t sosc_monotonic_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+#ifdef HAVE_TIMERFD
+int sosc_timer_new() {
+	return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+}
+
+/* deadline is in sosc_monotonic_us() time */
+void sosc_timer_arm(int fd, uint64_t deadline) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+
+	/* an it_value of zero disarms the timer */
+	if( deadline ) {
+		its.it_value.tv_sec  = deadline / 1000000;
+		its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+		if( !its.it_value.tv_sec && !its.it_value.tv_nsec )
+			its.it_value.tv_nsec = 1;
+	}
+
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void sosc_timer_ack(int fd) {
+	uint64_t expirations;
+
+	if( read(fd, &expirations, sizeof(expirations)) < 0 )
+		return;
+}
+#endif
@@ -21,11 +21,25 @@
 
 #include "serialosc.h"
 
+#ifdef SOSC_DEBUG
+/* debug builds count allocations per thread, so that code which mustn't
+   allocate can check that it doesn't (see NO_ALLOCS in src/server.c). */
+static SOSC_THREAD_LOCAL unsigned long alloc_count = 0;
+#define COUNT_ALLOC() (alloc_count++)
+
+unsigned long s_alloc_count() {
+	return alloc_count;
+}
+#else
+#define COUNT_ALLOC()
+#endif
+
 char *s_asprintf(const char *fmt, ...) {
 	va_list args;
 	char *buf;
 
 	va_start(args, fmt);
+	COUNT_ALLOC();
 
 	if( vasprintf(&buf, fmt, args) < 0 )
 		buf = NULL;
@@ -35,14 +49,17 @@ char *s_asprintf(const char *fmt, ...) {
 }
 
 void *s_malloc(size_t size) {
+	COUNT_ALLOC();
 	return malloc(size);
 }
 
 void *s_calloc(size_t nmemb, size_t size) {
+	COUNT_ALLOC();
 	return calloc(nmemb, size);
 }
 
 void *s_strdup(const char *s) {
+	COUNT_ALLOC();
 	return strdup(s);
 }
 
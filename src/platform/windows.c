@@ -26,10 +26,22 @@
 #include <sys/stat.h>
 #include <errno.h>
 
+#include <windows.h>
 #include <direct.h>
 
 #include "platform.h"
 
+#ifdef SOSC_DEBUG
+static SOSC_THREAD_LOCAL unsigned long alloc_count = 0;
+#define COUNT_ALLOC() (alloc_count++)
+
+unsigned long s_alloc_count() {
+	return alloc_count;
+}
+#else
+#define COUNT_ALLOC()
+#endif
+
 static int mk_monome_dir(char *cdir) {
 	int ret = 0;
 	char *last_slash = strrchr(cdir, '\\');
@@ -72,6 +84,30 @@ err_mkdir:
 	return 1;
 }
 
+uint64_t sosc_monotonic_us() {
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if( !freq.QuadPart )
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart) * 1000000
+		+ ((now.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart;
+}
+
+uint64_t sosc_monotonic_ns() {
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if( !freq.QuadPart )
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart) * 1000000000
+		+ ((now.QuadPart % freq.QuadPart) * 1000000000) / freq.QuadPart;
+}
+
 char *s_asprintf(const char *fmt, ...) {
 	va_list args;
 	char *buf;
@@ -90,14 +126,17 @@ char *s_asprintf(const char *fmt, ...) {
 }
 
 void *s_malloc(size_t size) {
+	COUNT_ALLOC();
 	return malloc(size);
 }
 
 void *s_calloc(size_t nmemb, size_t size) {
+	COUNT_ALLOC();
 	return calloc(nmemb, size);
 }
 
 void *s_strdup(const char *s) {
+	COUNT_ALLOC();
 	return _strdup(s);
 }
 
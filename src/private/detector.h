@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SOSC_DETECTOR_H
+#define SOSC_DETECTOR_H
+
+#include <stdint.h>
+
+/* hotplug debouncing for the POSIX detectors, see src/detector/common.c */
+
+typedef void (*sosc_hotplug_connect_t)(const char *devnode);
+
+typedef struct sosc_hotplug_node {
+	char *devnode;
+	int present;
+	uint64_t deadline;
+
+	struct sosc_hotplug_node *next;
+} sosc_hotplug_node_t;
+
+typedef struct {
+	/* how long a devnode has to go without events before we believe
+	   it, in microseconds */
+	uint64_t settle;
+
+	sosc_hotplug_connect_t connect;
+	sosc_hotplug_node_t *pending;
+} sosc_hotplug_t;
+
+void sosc_hotplug_init(sosc_hotplug_t *h, int settle_ms,
+                       sosc_hotplug_connect_t connect);
+void sosc_hotplug_fini(sosc_hotplug_t *h);
+
+void sosc_hotplug_event(sosc_hotplug_t *h, const char *devnode, int present);
+int  sosc_hotplug_timeout(const sosc_hotplug_t *h);
+void sosc_hotplug_service(sosc_hotplug_t *h);
+
+#endif /* defined SOSC_DETECTOR_H */
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOSC_DEVICES_H
+#define SOSC_DEVICES_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ipc.h"
+
+/* the supervisor's table of devices, see src/supervisor/devices.c */
+
+typedef struct sosc_device_info {
+	int ready;
+	int fd;
+
+	uint16_t port;
+	char *serial;
+	char *friendly;
+
+	/* what's come in on fd so far */
+	sosc_ipc_reader_t reader;
+
+	/* see src/supervisor/metrics.c */
+	struct {
+		/* when we started spawning it, in sosc_monotonic_us() time */
+		uint64_t spawned;
+
+		/* its latest stats report, when that came in, and how fast
+		   things were going since the one before */
+		sosc_ipc_stats_t last;
+		uint64_t last_at;
+		sosc_ipc_stats_t rate;
+	} metrics;
+} sosc_device_info_t;
+
+/* handles stay valid until their device is removed, and are never
+   reused: once removed, a stale handle just doesn't resolve. 0 is never
+   a valid handle. */
+typedef uint64_t sosc_dev_handle_t;
+
+typedef struct {
+	uint32_t generation;
+	int next_free;
+	int in_use;
+
+	sosc_device_info_t info;
+} sosc_dev_slot_t;
+
+typedef struct {
+	sosc_dev_slot_t *slots;
+	int capacity;
+	int count;
+	int free_head;
+
+	/* slot index by fd, or -1 */
+	int *by_fd;
+	int by_fd_len;
+} sosc_dev_table_t;
+
+void sosc_devs_init(sosc_dev_table_t *t);
+void sosc_devs_fini(sosc_dev_table_t *t);
+
+sosc_dev_handle_t sosc_devs_add(sosc_dev_table_t *t, int fd);
+void sosc_devs_remove(sosc_dev_table_t *t, sosc_dev_handle_t h);
+sosc_device_info_t *sosc_devs_get(sosc_dev_table_t *t, sosc_dev_handle_t h);
+
+sosc_dev_handle_t sosc_devs_by_fd(sosc_dev_table_t *t, int fd);
+sosc_dev_handle_t sosc_devs_by_serial(sosc_dev_table_t *t, const char *serial);
+sosc_dev_handle_t sosc_devs_by_port(sosc_dev_table_t *t, uint16_t port);
+
+/* for iterating over every device:
+
+     int i = -1;
+     while ((dev = sosc_devs_next(t, &i))) ... */
+sosc_device_info_t *sosc_devs_next(sosc_dev_table_t *t, int *i);
+
+#endif /* defined SOSC_DEVICES_H */
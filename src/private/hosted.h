@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <poll.h>
+
+/* running device servers inside the supervisor, see
+   src/supervisor/hosted.c */
+
+typedef struct {
+	/* number of worker threads, or 0 to drive every device from the
+	   supervisor's own loop */
+	int workers;
+
+	/* pin worker n to cpu n (modulo the number of cpus), linux only */
+	int pin;
+
+	/* if nonzero, run the workers at this SCHED_FIFO priority */
+	int fifo_priority;
+} sosc_hosted_config_t;
+
+int  sosc_supervisor_run_hosted(char *progname,
+                                const sosc_hosted_config_t *config);
+
+int  sosc_hosted_init(const sosc_hosted_config_t *config);
+void sosc_hosted_fini();
+int  sosc_hosted_start(const char *devnode);
+int  sosc_hosted_pollfds(struct pollfd *fds, int max);
+void sosc_hosted_handle(struct pollfd *fds, int nfds);
+int  sosc_hosted_timeout();
@@ -14,6 +14,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifndef SOSC_IPC_H
+#define SOSC_IPC_H
+
 #include <stdint.h>
 
 #ifndef PACKED
@@ -30,9 +33,21 @@ typedef enum {
 	SOSC_DEVICE_INFO,
 	SOSC_DEVICE_READY,
 	SOSC_DEVICE_DISCONNECTION,
-	SOSC_OSC_PORT_CHANGE
+	SOSC_OSC_PORT_CHANGE,
+	SOSC_DEVICE_STATS
 } sosc_ipc_type_t;
 
+/* a device server's running totals, sent every so often while they're
+   changing. see sosc_server_run_timers() in src/server.c */
+typedef struct {
+	uint64_t input;
+	uint64_t datagrams_in;
+	uint64_t datagrams_out;
+	uint64_t mext_handled;
+	uint64_t serial_bytes;
+	uint64_t leds_skipped;
+} PACKED sosc_ipc_stats_t;
+
 typedef struct {
 	sosc_ipc_type_t type;
 
@@ -49,13 +64,32 @@ typedef struct {
 		struct {
 			uint16_t port;
 		} PACKED port_change;
+
+		sosc_ipc_stats_t stats;
 	};
 
 	uint16_t magic;
 } PACKED sosc_ipc_msg_t;
 
+/* the longest message which can be sent over a file descriptor. with
+   the frame length in front, that's _POSIX_PIPE_BUF, the smallest
+   PIPE_BUF allowed, so that writes to pipes are always atomic. */
+#define SOSC_IPC_MAX_FRAME 510
+
+/* the receiving end of a file descriptor, see src/ipc.c */
+typedef struct {
+	/* room for one frame, length and all */
+	uint8_t buf[sizeof(uint16_t) + SOSC_IPC_MAX_FRAME];
+	size_t len;
+} sosc_ipc_reader_t;
+
 int sosc_ipc_msg_write(int fd, sosc_ipc_msg_t *msg);
-int sosc_ipc_msg_read(int fd, sosc_ipc_msg_t *buf);
+
+void sosc_ipc_reader_init(sosc_ipc_reader_t *r);
+ssize_t sosc_ipc_reader_fill(sosc_ipc_reader_t *r, int fd);
+int sosc_ipc_reader_next(sosc_ipc_reader_t *r, sosc_ipc_msg_t *msg);
 
 ssize_t sosc_ipc_msg_to_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t *msg);
 ssize_t sosc_ipc_msg_from_buf(uint8_t *buf, size_t nbytes, sosc_ipc_msg_t **msg);
+
+#endif /* defined SOSC_IPC_H */
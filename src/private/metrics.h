@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SOSC_METRICS_H
+#define SOSC_METRICS_H
+
+#include "serialosc.h"
+#include "devices.h"
+
+/* the supervisor's running totals, see src/supervisor/metrics.c */
+
+void sosc_metrics_set_file(const char *path);
+void sosc_metrics_init();
+
+void sosc_metrics_hotplug();
+void sosc_metrics_spawned(sosc_device_info_t *dev, uint64_t started);
+void sosc_metrics_ready(sosc_device_info_t *dev);
+void sosc_metrics_report(sosc_device_info_t *dev, const sosc_ipc_stats_t *s);
+void sosc_metrics_removed(sosc_device_info_t *dev, int clean);
+
+void sosc_metrics_reply(sosc_sendq_t *q, const char *host, const char *port,
+                        sosc_dev_table_t *devs);
+
+int  sosc_metrics_timeout();
+void sosc_metrics_service(sosc_dev_table_t *devs);
+
+#endif /* defined SOSC_METRICS_H */
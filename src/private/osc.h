@@ -22,9 +22,69 @@
 				 lo_arg **argv, int argc,\
 				 lo_message data, void *user_data)
 
+/* the most arguments any of the mext methods takes (/grid/led/level/map) */
+#define OSC_MEXT_MAX_ARGS 66
+
+typedef int (sosc_mext_func_t)(sosc_state_t *state,
+                               const int32_t *argv, int argc);
+
+typedef struct {
+	/* relative to the prefix */
+	const char *path;
+
+	/* NULL means the method checks its arguments itself */
+	const char *typespec;
+
+	/* NULL for methods which don't take integers, which are left to
+	   liblo to dispatch. */
+	sosc_mext_func_t *func;
+	lo_method_handler handler;
+} sosc_osc_method_t;
+
+/* in src/osc/mext_methods.c, terminated by an entry with a NULL path */
+extern const sosc_osc_method_t osc_mext_methods[];
+
 void osc_register_sys_methods(sosc_state_t *state);
 
 void osc_register_methods(sosc_state_t *state);
-void osc_unregister_methods(sosc_state_t *state);
 
 char *osc_path(const char *path, const char *prefix);
+
+void osc_build_event_templates(sosc_state_t *state);
+void osc_free_event_templates(sosc_state_t *state);
+
+int  osc_template_init(sosc_osc_template_t *t, const char *path, int argc);
+void osc_template_free(sosc_osc_template_t *t);
+void osc_template_set_int(sosc_osc_template_t *t, int idx, int32_t val);
+int  osc_template_send(sosc_state_t *state, sosc_osc_template_t *t);
+
+int  osc_send_raw(sosc_state_t *state, const uint8_t *buf, size_t len);
+
+int  osc_bundle_add(sosc_state_t *state, const uint8_t *msg, size_t len);
+int  osc_bundle_flush(sosc_state_t *state);
+uint64_t osc_bundle_deadline(const sosc_state_t *state);
+void osc_bundle_service(sosc_state_t *state);
+
+int  osc_resolve(int fd, const char *host, const char *port,
+                 struct sockaddr_storage *addr, socklen_t *len);
+int  osc_resolve_outgoing(sosc_state_t *state);
+uint64_t osc_resolve_deadline(const sosc_state_t *state);
+void osc_resolve_service(sosc_state_t *state);
+
+void osc_sendq_init(sosc_sendq_t *q, int fd);
+int  osc_sendq_add(sosc_sendq_t *q, const char *host, const char *port,
+                   const char *path, lo_message msg);
+int  osc_sendq_add_addr(sosc_sendq_t *q, const struct sockaddr_storage *addr,
+                        socklen_t addrlen, const char *path, lo_message msg);
+int  osc_sendq_flush(sosc_sendq_t *q);
+
+void osc_dispatch_build(sosc_state_t *state);
+void osc_dispatch_set_prefix(sosc_state_t *state, char *prefix);
+const sosc_osc_method_t *osc_dispatch_lookup(const sosc_state_t *state,
+                                             const char *path);
+int  osc_dispatch(sosc_state_t *state, const uint8_t *buf, size_t len);
+int  osc_recv_init(sosc_state_t *state);
+void osc_recv_free(sosc_state_t *state);
+int  osc_recv(sosc_state_t *state, int max);
+uint64_t osc_queue_deadline(const sosc_state_t *state);
+void osc_queue_service(sosc_state_t *state);
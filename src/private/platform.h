@@ -14,10 +14,31 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
+
+/* for per-thread scratch space, so that device servers running on
+   different threads (see src/supervisor/hosted.c) don't share it */
+#ifdef _MSC_VER
+#define SOSC_THREAD_LOCAL __declspec(thread)
+#else
+#define SOSC_THREAD_LOCAL __thread
+#endif
+
 char *sosc_get_config_directory();
 
+/* microseconds since some arbitrary point, never goes backwards */
+uint64_t sosc_monotonic_us();
+uint64_t sosc_monotonic_ns();
+
 char *s_asprintf(const char *fmt, ...);
 void *s_malloc(size_t size);
 void *s_calloc(size_t nmemb, size_t size);
 void *s_strdup(const char *s);
 void s_free(void *ptr);
+
+#ifdef SOSC_DEBUG
+/* number of allocations made by this thread through the s_* functions so
+   far. used to check that hot paths (i.e. sending key presses) never
+   allocate. */
+unsigned long s_alloc_count();
+#endif
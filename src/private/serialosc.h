@@ -21,6 +21,13 @@
 #include <dns_sd.h>
 #endif
 
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
 #include <lo/lo.h>
 #include <monome.h>
 
@@ -32,46 +39,352 @@
 #define SOSC_SUPERVISOR_OSC_PORT "12002"
 #define SOSC_WIN_SERVICE_NAME "serialosc"
 
+/* big enough for a 512 in any rotation */
+#define SOSC_MAX_GRID_SIZE 32
+
+/* slots in the mext method hash table, see src/osc/dispatch.c */
+#define SOSC_DISPATCH_SLOTS 64
+
+/* datagrams pulled off the OSC socket per recvmmsg(), and the largest
+   datagram we'll take (the same as liblo's limit). see
+   src/osc/dispatch.c */
+#define SOSC_RECV_BATCH 16
+#define SOSC_RECV_BUF_SIZE 32768
+
+/* enough counters for every method in osc_mext_methods[], see
+   src/osc/mext_methods.c */
+#define SOSC_MAX_MEXT_METHODS 24
+
+/* outgoing datagrams held for one sendmmsg(), see src/osc/sendq.c */
+#define SOSC_SENDQ_LEN 32
+#define SOSC_SENDQ_BUF_SIZE 8192
+
+/* device servers tell the supervisor how they're doing at most this
+   often (in microseconds), and only while their counters are moving.
+   see src/server.c */
+#define SOSC_STATS_REPORT_INTERVAL 1000000
+
+/* how often (in microseconds) to try resolving the application's host
+   again, while it won't. see src/osc/template.c */
+#define SOSC_RESOLVE_RETRY_INTERVAL 1000000
+
+/* ethernet MTU, less the IP and UDP headers */
+#define SOSC_MAX_BUNDLE_SIZE 1472
+
 typedef struct {
 	struct {
 		char port[6];
+
+		/* maximum number of serial events or OSC datagrams handled per
+		   event loop wakeup, see sosc_server_drain_monome() */
+		int drain_budget;
 	} server;
 
 	struct {
 		char *osc_prefix;
 		char *host;
 		char port[6];
+
+		/* collect device events into OSC bundles. events are held for
+		   up to `window` microseconds, or if that's 0, until the serial
+		   buffer has been drained. */
+		struct {
+			int enabled;
+			int window;
+		} bundle;
 	} app;
 
 	struct {
 		monome_rotate_t rotation;
+
+		/* if nonzero, grid LED writes are collected and sent to the
+		   device at most this many times a second. */
+		int led_rate;
 	} dev;
 } sosc_config_t;
 
+/* which serial devices the detector reports to the supervisor. each
+   field is an fnmatch(3) pattern matched against the device's USB
+   vendor id, product id and serial string, and a NULL field matches
+   anything. see src/detector/common.c */
+typedef struct {
+	char *vendor_id;
+	char *model_id;
+	char *serial;
+} sosc_device_match_t;
+
+typedef struct {
+	/* if there are any, a device has to match at least one of these */
+	sosc_device_match_t *match;
+	int nmatch;
+
+	/* and none of these */
+	sosc_device_match_t *ignore;
+	int nignore;
+
+	/* milliseconds a device has to stay put after being plugged in or
+	   removed before it's reported, or 0 to report it straight away */
+	int settle_time;
+} sosc_detector_config_t;
+
+/* a fully encoded OSC message with a fixed path and only int32 arguments.
+   sending one means patching the argument slots and handing the buffer
+   to sendto(). see src/osc/template.c */
+typedef struct {
+	uint8_t *data;
+	size_t len;
+
+	uint8_t *args;
+	int argc;
+} sosc_osc_template_t;
+
+/* replies and notifications which go out in bursts (/sys/info, device
+   lists) are queued up here and then sent all at once. see
+   src/osc/sendq.c */
+typedef struct {
+	int fd;
+
+	int count;
+	size_t used;
+
+	struct {
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+
+		size_t off;
+		size_t len;
+	} msgs[SOSC_SENDQ_LEN];
+
+	/* a burst usually all goes to one place, so we hang on to the last
+	   address we resolved until the queue is flushed. */
+	struct {
+		char host[256];
+		char port[6];
+
+		struct sockaddr_storage addr;
+		socklen_t len;
+	} last;
+
+	uint8_t buf[SOSC_SENDQ_BUF_SIZE];
+
+	/* datagrams which made it out, ever */
+	uint64_t sent;
+} sosc_sendq_t;
+
+typedef enum {
+	SOSC_INPUT_KEY,
+	SOSC_INPUT_ENC_DELTA,
+	SOSC_INPUT_ENC_KEY,
+	SOSC_INPUT_TILT,
+
+	SOSC_INPUT_MAX
+} sosc_input_type_t;
+
+/* running totals, only touched by whichever loop drives the state.
+   reported by /sys/stats, see src/osc/sys_methods.c */
+typedef struct {
+	/* device events, by sosc_input_type_t */
+	uint64_t input[SOSC_INPUT_MAX];
+
+	/* OSC datagrams pulled off the server's socket, and sent other than
+	   through state->sendq (which keeps its own count) */
+	uint64_t datagrams_in;
+	uint64_t datagrams_out;
+
+	/* mext method calls received, by index into osc_mext_methods[], and
+	   how many of them made it through to their handler */
+	uint64_t mext_calls[SOSC_MAX_MEXT_METHODS];
+	uint64_t mext_handled;
+
+	/* as reported by libmonome */
+	uint64_t serial_bytes;
+
+	uint64_t wakeups;
+
+	/* time spent handling each incoming datagram */
+	uint64_t handler_ns_total;
+	uint64_t handler_ns_max;
+
+	/* grid LED writes which never went to the device: dropped because
+	   the shadow said they wouldn't change anything, or folded into the
+	   frame (see config.dev.led_rate) */
+	uint64_t leds_dropped;
+	uint64_t leds_coalesced;
+} sosc_stats_t;
+
+/* latencies in nanoseconds, bucketed like an HDR histogram: each power
+   of two is split into 2^SOSC_HIST_SUB_BITS linear steps, so a bucket is
+   never more than about 6% wide. anything from 2^SOSC_HIST_MAX_BITS ns
+   (a couple of minutes) up lands in the last bucket. see src/latency.c */
+#define SOSC_HIST_SUB_BITS 4
+#define SOSC_HIST_MAX_BITS 37
+#define SOSC_HIST_BUCKETS \
+	((SOSC_HIST_MAX_BITS - SOSC_HIST_SUB_BITS + 1) << SOSC_HIST_SUB_BITS)
+
+/* count, p50, p90, p99, p99.9, max */
+#define SOSC_HIST_SUMMARY 6
+
+typedef struct {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[SOSC_HIST_BUCKETS];
+} sosc_histogram_t;
+
+/* what we last told the grid's LEDs to show, in application (that is,
+   rotated) coordinates. on/off writes are stored as levels 0 and 15.
+   see src/shadow.c */
+typedef struct {
+	int cols;
+	int rows;
+
+	uint8_t levels[SOSC_MAX_GRID_SIZE][SOSC_MAX_GRID_SIZE];
+} sosc_shadow_t;
+
 typedef struct {
 	monome_t *monome;
 	lo_address *outgoing;
 	lo_server *server;
 	int ipc_fd;
 
+	/* state->outgoing, resolved for use with sendto() */
+	struct {
+		struct sockaddr_storage addr;
+		socklen_t len;
+
+		/* when to try again if it didn't resolve, otherwise 0 */
+		uint64_t retry;
+	} outgoing_addr;
+
+	sosc_sendq_t sendq;
+
+	/* SOSC_RECV_BATCH buffers of SOSC_RECV_BUF_SIZE for incoming
+	   datagrams, see osc_recv_init() */
+	uint8_t *recv_bufs;
+
+	/* pre-encoded messages for device events, rebuilt whenever the prefix
+	   changes so that sending an event doesn't have to allocate. */
+	struct {
+		sosc_osc_template_t grid_key;
+		sosc_osc_template_t enc_delta;
+		sosc_osc_template_t enc_key;
+		sosc_osc_template_t tilt;
+	} templates;
+
+	/* routing for the mext methods: the prefix they live under, and a
+	   perfect hash of the paths below it. see src/osc/dispatch.c */
+	struct {
+		struct {
+			const char *str;
+			size_t len;
+		} prefix;
+
+		uint32_t seed;
+		int8_t slots[SOSC_DISPATCH_SLOTS];
+	} dispatch;
+
+	sosc_shadow_t shadow;
+
+	/* with config.dev.led_rate set, grid LED writes land here rather
+	   than going straight to the device, and get flushed out a quad at
+	   a time. see src/frame.c */
+	struct {
+		uint8_t levels[SOSC_MAX_GRID_SIZE][SOSC_MAX_GRID_SIZE];
+
+		/* one bit per 8x8 quad */
+		uint16_t dirty;
+
+		/* the earliest the next flush is allowed to go out */
+		uint64_t next_flush;
+	} frame;
+
+	/* device events waiting to go out together, see config.app.bundle */
+	struct {
+		uint8_t buf[SOSC_MAX_BUNDLE_SIZE];
+		size_t len;
+		uint64_t deadline;
+	} bundle;
+
 #ifndef SOSC_NO_ZEROCONF
 	DNSServiceRef ref;
 #endif
 
+	sosc_stats_t stats;
+
+	/* like stats, only touched by the loop which drives the state. see
+	   src/latency.c */
+	struct {
+		/* when the loop last woke up, in sosc_monotonic_ns() time */
+		uint64_t woke;
+
+		/* the last dump request we've seen to */
+		int dumped;
+
+		/* a device event coming in to it going out over OSC, an OSC
+		   datagram coming in to it being written to the device, and
+		   how late the loop woke up for a deadline */
+		sosc_histogram_t input;
+		sosc_histogram_t output;
+		sosc_histogram_t jitter;
+	} latency;
+
+	/* when the supervisor is next due our stats, or 0 if nothing's
+	   changed since it last got them */
+	struct {
+		uint64_t deadline;
+		uint64_t sum;
+	} report;
+
 	sosc_config_t config;
 } sosc_state_t;
 
-int  sosc_event_loop(const sosc_state_t *state);
+int  sosc_event_loop(sosc_state_t *state);
 int  sosc_detector_run(const char *exec);
 void sosc_server_run(monome_t *monome);
+int  sosc_server_start(sosc_state_t *state);
+void sosc_server_stop(sosc_state_t *state);
 int  sosc_supervisor_run(char *progname);
 
 int sosc_config_create_directory();
 int sosc_config_read(const char *serial, sosc_config_t *config);
 int sosc_config_write(const char *serial, sosc_state_t *state);
+int sosc_detector_config_read(sosc_detector_config_t *config);
+void sosc_detector_config_free(sosc_detector_config_t *config);
+
+int sosc_device_match(const sosc_detector_config_t *config,
+                      const char *vendor_id, const char *model_id,
+                      const char *serial);
 
 void sosc_port_itos(char *dest, long int port);
 
+void sosc_shadow_init(sosc_shadow_t *shadow, int cols, int rows);
+int  sosc_shadow_fill(sosc_shadow_t *shadow, int level);
+int  sosc_shadow_update(sosc_shadow_t *shadow, int x, int y, int level);
+
+void sosc_frame_set(sosc_state_t *state, int x, int y, int level);
+void sosc_frame_fill(sosc_state_t *state, int level);
+void sosc_frame_redraw(sosc_state_t *state);
+uint64_t sosc_frame_deadline(const sosc_state_t *state);
+void sosc_frame_service(sosc_state_t *state);
+
+int  sosc_server_serial_written(sosc_state_t *state, int written);
+
+void sosc_server_drain_monome(sosc_state_t *state);
+void sosc_server_drain_osc(sosc_state_t *state);
+
+uint64_t sosc_server_next_deadline(const sosc_state_t *state);
+int  sosc_server_timeout(const sosc_state_t *state);
+void sosc_server_run_timers(sosc_state_t *state);
+
+void sosc_histogram_record(sosc_histogram_t *h, uint64_t ns);
+void sosc_histogram_summary(const sosc_histogram_t *h, uint64_t *v);
+
+void sosc_latency_catch_signal();
+void sosc_latency_init(sosc_state_t *state);
+void sosc_latency_woke(sosc_state_t *state);
+void sosc_latency_since_woke(sosc_state_t *state, sosc_histogram_t *h);
+void sosc_latency_dump(sosc_state_t *state);
+void sosc_latency_service(sosc_state_t *state);
+
 void sosc_zeroconf_init();
 void sosc_zeroconf_register(sosc_state_t *state, const char *svc_name);
 void sosc_zeroconf_unregister(sosc_state_t *state);
@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SOSC_TIMER_H
+#define SOSC_TIMER_H
+
+#include <stdint.h>
+
+/* shared by the poll and epoll event loops. with a timerfd they can
+   sleep right up until the next deadline, rather than rounding it to
+   the millisecond for the wait timeout. see src/platform/linux.c */
+
+#ifdef HAVE_TIMERFD
+int  sosc_timer_new();
+void sosc_timer_arm(int fd, uint64_t deadline);
+void sosc_timer_ack(int fd);
+
+#define SOSC_WAIT_TIMEOUT(state) -1
+#else
+#define SOSC_WAIT_TIMEOUT(state) sosc_server_timeout(state)
+#endif
+
+#endif /* defined SOSC_TIMER_H */
@@ -20,14 +20,90 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
 #include <monome.h>
 #include "serialosc.h"
 
+#ifndef WIN32
+#include "hosted.h"
+#include "metrics.h"
+#endif
+
 static void print_version()
 {
 	printf("serialosc %s (%s)\n", VERSION, GIT_COMMIT);
 }
 
+#ifndef WIN32
+static void print_usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage: %s [-v] [-s [-t threads [-p] [-f priority]]] [-m file]\n"
+		"\n"
+		"  -s           run every device in this process\n"
+		"  -t threads   ...spread across this many worker threads\n"
+		"  -p           pin each worker thread to a cpu\n"
+		"  -f priority  run the workers at this SCHED_FIFO priority\n"
+		"  -m file      write prometheus metrics to this file\n",
+		progname);
+}
+
+static int run_supervisor(int argc, char **argv)
+{
+	sosc_hosted_config_t config = {0, 0, 0};
+	int opt, hosted = 0, ret;
+
+	while ((opt = getopt(argc, argv, "st:pf:m:")) != -1) {
+		switch (opt) {
+		case 's':
+			hosted = 1;
+			break;
+
+		case 't':
+			hosted = 1;
+			config.workers = atoi(optarg);
+			break;
+
+		case 'p':
+			hosted = 1;
+			config.pin = 1;
+			break;
+
+		case 'f':
+			hosted = 1;
+			config.fifo_priority = atoi(optarg);
+			break;
+
+		case 'm':
+			sosc_metrics_set_file(optarg);
+			break;
+
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config.workers < 0 || config.fifo_priority < 0) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (hosted) {
+		setenv("AVAHI_COMPAT_NOWARN", "shut up", 1);
+		sosc_zeroconf_init();
+
+		ret = sosc_supervisor_run_hosted(argv[0], &config);
+	} else
+		ret = sosc_supervisor_run(argv[0]);
+
+	return (ret) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	monome_t *device;
@@ -69,6 +145,14 @@ int main(int argc, char **argv)
 			return EXIT_SUCCESS;
 	}
 
+#ifndef WIN32
+	/* any other option is for the supervisor. -s and friends mean
+	   single-process mode, where it runs every device's OSC server
+	   itself rather than spawning a process for each. */
+	if (argv[1][0] == '-' && argv[1][1] != 'v')
+		return run_supervisor(argc, argv);
+#endif
+
 	/* if the only parameter is -v, print the version and exit */
 	if (argv[1][0] == '-' && argv[1][1] == 'v') {
 		print_version();
@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -41,6 +42,19 @@
 #define DEFAULT_ROTATION        MONOME_ROTATE_0
 
 
+#ifdef SOSC_DEBUG
+/* sending a device event should never touch the allocator. debug builds
+   check that this holds. */
+#define NO_ALLOCS(x) do {                       \
+		unsigned long allocs = s_alloc_count(); \
+		x;                                      \
+		assert(s_alloc_count() == allocs);      \
+	} while (0)
+#else
+#define NO_ALLOCS(x) x
+#endif
+
+
 static void lo_error(int num, const char *error_msg, const char *path) {
 	fprintf(stderr, "serialosc: lo server error %d in %s: %s\n",
 	        num, path, error_msg);
@@ -55,42 +69,180 @@ static const char *null_if_zero(const char *s) {
 
 static void handle_press(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	sosc_osc_template_t *t = &state->templates.grid_key;
 
-	cmd = osc_path("grid/key", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "iii",
-	             e->grid.x, e->grid.y, e->event_type == MONOME_BUTTON_DOWN);
-	s_free(cmd);
+	osc_template_set_int(t, 0, e->grid.x);
+	osc_template_set_int(t, 1, e->grid.y);
+	osc_template_set_int(t, 2, e->event_type == MONOME_BUTTON_DOWN);
+
+	state->stats.input[SOSC_INPUT_KEY]++;
+	NO_ALLOCS(osc_template_send(state, t));
+	sosc_latency_since_woke(state, &state->latency.input);
 }
 
 static void handle_enc_delta(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	sosc_osc_template_t *t = &state->templates.enc_delta;
+
+	osc_template_set_int(t, 0, e->encoder.number);
+	osc_template_set_int(t, 1, e->encoder.delta);
 
-	cmd = osc_path("enc/delta", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "ii",
-	             e->encoder.number, e->encoder.delta);
-	s_free(cmd);
+	state->stats.input[SOSC_INPUT_ENC_DELTA]++;
+	NO_ALLOCS(osc_template_send(state, t));
+	sosc_latency_since_woke(state, &state->latency.input);
 }
 
 static void handle_enc_key(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	sosc_osc_template_t *t = &state->templates.enc_key;
 
-	cmd = osc_path("enc/key", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "ii",
-	             e->encoder.number, e->event_type == MONOME_ENCODER_KEY_DOWN);
-	s_free(cmd);
+	osc_template_set_int(t, 0, e->encoder.number);
+	osc_template_set_int(t, 1, e->event_type == MONOME_ENCODER_KEY_DOWN);
+
+	state->stats.input[SOSC_INPUT_ENC_KEY]++;
+	NO_ALLOCS(osc_template_send(state, t));
+	sosc_latency_since_woke(state, &state->latency.input);
 }
 
 static void handle_tilt(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	sosc_osc_template_t *t = &state->templates.tilt;
+
+	osc_template_set_int(t, 0, e->tilt.sensor);
+	osc_template_set_int(t, 1, e->tilt.x);
+	osc_template_set_int(t, 2, e->tilt.y);
+	osc_template_set_int(t, 3, e->tilt.z);
+
+	state->stats.input[SOSC_INPUT_TILT]++;
+	NO_ALLOCS(osc_template_send(state, t));
+	sosc_latency_since_woke(state, &state->latency.input);
+}
+
+/**
+ * timers
+ *
+ * the event loops don't know about bundles or LED frames, they just wait
+ * until the next deadline and then let us sort it out.
+ */
+
+static uint64_t earliest(uint64_t a, uint64_t b)
+{
+	if (!a || !b)
+		return a | b;
+
+	return (a < b) ? a : b;
+}
+
+uint64_t sosc_server_next_deadline(const sosc_state_t *state)
+{
+	uint64_t deadline;
+
+	deadline = earliest(osc_bundle_deadline(state), sosc_frame_deadline(state));
+	deadline = earliest(deadline, osc_resolve_deadline(state));
+	deadline = earliest(deadline, osc_queue_deadline(state));
+	return earliest(deadline, state->report.deadline);
+}
+
+/* milliseconds until the next deadline, for use as a poll() timeout.
+   -1 if there's nothing to wait for. */
+int sosc_server_timeout(const sosc_state_t *state)
+{
+	uint64_t deadline, now;
+
+	if (!(deadline = sosc_server_next_deadline(state)))
+		return -1;
+
+	now = sosc_monotonic_us();
+
+	if (now >= deadline)
+		return 0;
+
+	/* round up, otherwise we'd spin until the deadline */
+	return (deadline - now + 999) / 1000;
+}
+
+static void send_device_stats(sosc_state_t *state);
+
+static void fill_device_stats(const sosc_state_t *state, sosc_ipc_stats_t *s)
+{
+	int i;
+
+	s->input = 0;
+	for (i = 0; i < SOSC_INPUT_MAX; i++)
+		s->input += state->stats.input[i];
+
+	s->datagrams_in  = state->stats.datagrams_in;
+	s->datagrams_out = state->stats.datagrams_out + state->sendq.sent;
+	s->mext_handled  = state->stats.mext_handled;
+	s->serial_bytes  = state->stats.serial_bytes;
+	s->leds_skipped  = state->stats.leds_dropped + state->stats.leds_coalesced;
+}
+
+/* the first change after a report starts the clock on the next one, so
+   an idle device never wakes up just to say that nothing happened. */
+static void report_service(sosc_state_t *state)
+{
+	sosc_ipc_stats_t s;
+	uint64_t sum;
+
+	if (state->ipc_fd < 0)
+		return;
+
+	fill_device_stats(state, &s);
+	sum = s.input + s.datagrams_in + s.datagrams_out + s.serial_bytes;
+
+	if (!state->report.deadline) {
+		if (sum != state->report.sum)
+			state->report.deadline =
+				sosc_monotonic_us() + SOSC_STATS_REPORT_INTERVAL;
+
+		return;
+	}
+
+	if (sosc_monotonic_us() < state->report.deadline)
+		return;
 
-	cmd = osc_path("tilt", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "iiii",
-	             e->tilt.sensor, e->tilt.x, e->tilt.y, e->tilt.z);
-	s_free(cmd);
+	send_device_stats(state);
+
+	state->report.sum = sum;
+	state->report.deadline = 0;
+}
+
+/**
+ * draining
+ *
+ * the event loops call these when the serial port or the OSC socket is
+ * readable. they're all level-triggered, so anything left over once the
+ * budget runs out wakes the loop straight back up.
+ */
+
+void sosc_server_drain_monome(sosc_state_t *state)
+{
+	int budget = state->config.server.drain_budget;
+
+	while (budget-- && monome_event_handle_next(state->monome));
+}
+
+void sosc_server_drain_osc(sosc_state_t *state)
+{
+	int budget = state->config.server.drain_budget, n;
+
+	while (budget > 0 && (n = osc_recv(state, budget)))
+		budget -= n;
+}
+
+/* every event loop calls this once each time it wakes up, after the
+   serial port has been read from. */
+void sosc_server_run_timers(sosc_state_t *state)
+{
+	state->stats.wakeups++;
+
+	osc_resolve_service(state);
+	osc_queue_service(state);
+	osc_bundle_service(state);
+	sosc_frame_service(state);
+	report_service(state);
+	sosc_latency_service(state);
 }
 
 static void send_connection_status(sosc_state_t *state, int status) {
@@ -100,7 +252,19 @@ static void send_connection_status(sosc_state_t *state, int status) {
 	};
 
 	cmd = cmds[status & 1];
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "");
+
+	if( lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE,
+	                 cmd, "") >= 0 )
+		state->stats.datagrams_out++;
+}
+
+/* for wrapping libmonome LED calls, which return the number of bytes
+   they wrote to the device, or -1. passes the return value through. */
+int sosc_server_serial_written(sosc_state_t *state, int written) {
+	if( written > 0 )
+		state->stats.serial_bytes += written;
+
+	return written;
 }
 
 #ifndef WIN32
@@ -136,12 +300,22 @@ static void send_osc_port_change(int fd, uint16_t port)
 
 	sosc_ipc_msg_write(fd, &msg);
 }
+
+static void send_device_stats(sosc_state_t *state)
+{
+	sosc_ipc_msg_t msg = {
+		.type = SOSC_DEVICE_STATS,
+	};
+
+	fill_device_stats(state, &msg.stats);
+	sosc_ipc_msg_write(state->ipc_fd, &msg);
+}
 #else
 /* windows. */
 static void send_ipc_msg(sosc_ipc_msg_t *msg)
 {
 	HANDLE p = (HANDLE) _get_osfhandle(STDOUT_FILENO);
-	uint8_t buf[64];
+	uint8_t buf[SOSC_IPC_MAX_FRAME];
 	DWORD written;
 	ssize_t bufsiz;
 
@@ -186,46 +360,74 @@ static void send_osc_port_change(int fd, uint16_t port)
 
 	send_ipc_msg(&msg);
 }
+
+static void send_device_stats(sosc_state_t *state)
+{
+	sosc_ipc_msg_t msg = {
+		.type = SOSC_DEVICE_STATS,
+	};
+
+	fill_device_stats(state, &msg.stats);
+	send_ipc_msg(&msg);
+}
 #endif
 
-void sosc_server_run(monome_t *monome)
+/**
+ * lifecycle
+ *
+ * sosc_server_start() and sosc_server_stop() bring a device's server up
+ * and down around whichever event loop ends up driving it: its own, in
+ * the per-device process, or the supervisor's (see
+ * src/supervisor/hosted.c). state->monome and state->ipc_fd have to be
+ * filled in beforehand, and state has to stay put until it's stopped.
+ */
+
+int sosc_server_start(sosc_state_t *state)
 {
 	char *svc_name;
-	sosc_state_t state = {
-		.monome = monome,
-		.ipc_fd = (!isatty(STDOUT_FILENO)) ? STDOUT_FILENO : -1
-	};
 
-	if( sosc_config_read(monome_get_serial(state.monome), &state.config) ) {
+	sosc_latency_init(state);
+
+	if( sosc_config_read(monome_get_serial(state->monome), &state->config) ) {
 		fprintf(
 			stderr, "serialosc [%s]: couldn't read config, using defaults\n",
-			monome_get_serial(state.monome));
+			monome_get_serial(state->monome));
 	}
 
-	if( !(state.server = lo_server_new(null_if_zero(state.config.server.port),
+	if( !(state->server = lo_server_new(null_if_zero(state->config.server.port),
 									   lo_error)) )
 		goto err_server_new;
 
-	if( !(state.outgoing = lo_address_new(
-				state.config.app.host, null_if_zero(state.config.app.port))) ) {
+	if( !(state->outgoing = lo_address_new(
+				state->config.app.host, null_if_zero(state->config.app.port))) ) {
 		fprintf(
 			stderr, "serialosc [%s]: couldn't allocate lo_address, aieee!\n",
-			monome_get_serial(state.monome));
+			monome_get_serial(state->monome));
 		goto err_lo_addr;
 	}
 
+	osc_resolve_outgoing(state);
+	osc_sendq_init(&state->sendq, lo_server_get_socket_fd(state->server));
+
+	if( osc_recv_init(state) ) {
+		fprintf(
+			stderr, "serialosc [%s]: couldn't allocate memory, aieee!\n",
+			monome_get_serial(state->monome));
+		goto err_recv_init;
+	}
+
 	svc_name = s_asprintf(
-		"%s (%s)", monome_get_friendly_name(state.monome),
-		monome_get_serial(state.monome));
+		"%s (%s)", monome_get_friendly_name(state->monome),
+		monome_get_serial(state->monome));
 
 	if( !svc_name ) {
 		fprintf(
 			stderr, "serialosc [%s]: couldn't allocate memory, aieee!\n",
-			monome_get_serial(state.monome));
+			monome_get_serial(state->monome));
 		goto err_svc_name;
 	}
 
-#define HANDLE(ev, cb) monome_register_handler(state.monome, ev, cb, &state)
+#define HANDLE(ev, cb) monome_register_handler(state->monome, ev, cb, state)
 	HANDLE(MONOME_BUTTON_DOWN, handle_press);
 	HANDLE(MONOME_BUTTON_UP, handle_press);
 	HANDLE(MONOME_ENCODER_DELTA, handle_enc_delta);
@@ -234,49 +436,91 @@ void sosc_server_run(monome_t *monome)
 	HANDLE(MONOME_TILT, handle_tilt);
 #undef HANDLE
 
-	monome_set_rotation(state.monome, state.config.dev.rotation);
-	monome_led_all(state.monome, 0);
+	monome_set_rotation(state->monome, state->config.dev.rotation);
+	sosc_server_serial_written(state, monome_led_all(state->monome, 0));
+
+	sosc_shadow_init(&state->shadow, monome_get_cols(state->monome),
+	                 monome_get_rows(state->monome));
+	sosc_shadow_fill(&state->shadow, 0);
 
-	osc_register_sys_methods(&state);
-	osc_register_methods(&state);
+	osc_register_sys_methods(state);
+	osc_register_methods(state);
+	osc_build_event_templates(state);
 
-	if (state.ipc_fd < 0) {
+	if (state->ipc_fd < 0) {
 		fprintf(
 			stderr, "serialosc [%s]: connected, server running on port %d\n",
-			monome_get_serial(state.monome), lo_server_get_port(state.server));
+			monome_get_serial(state->monome), lo_server_get_port(state->server));
 	} else {
-		send_device_info(state.ipc_fd, monome);
+		send_device_info(state->ipc_fd, state->monome);
 		send_osc_port_change(
-			state.ipc_fd, lo_server_get_port(state.server));
-		send_simple_ipc(state.ipc_fd, SOSC_DEVICE_READY);
+			state->ipc_fd, lo_server_get_port(state->server));
+		send_simple_ipc(state->ipc_fd, SOSC_DEVICE_READY);
 	}
 
-	sosc_zeroconf_register(&state, svc_name);
+	sosc_zeroconf_register(state, svc_name);
 	free(svc_name);
 
-	send_connection_status(&state, 1);
-	sosc_event_loop(&state);
-	send_connection_status(&state, 0);
+	send_connection_status(state, 1);
+	return 0;
+
+err_svc_name:
+	osc_recv_free(state);
+err_recv_init:
+	lo_address_free(state->outgoing);
+err_lo_addr:
+	lo_server_free(state->server);
+err_server_new:
+	osc_free_event_templates(state);
+	s_free(state->config.app.osc_prefix);
+	s_free(state->config.app.host);
 
-	sosc_zeroconf_unregister(&state);
+	return -1;
+}
 
-	if (state.ipc_fd < 0) {
+void sosc_server_stop(sosc_state_t *state)
+{
+	osc_bundle_flush(state);
+	send_connection_status(state, 0);
+
+	sosc_zeroconf_unregister(state);
+
+	if (state->ipc_fd < 0) {
 		fprintf(stderr, "serialosc [%s]: disconnected, exiting\n",
-				monome_get_serial(state.monome));
-	} else
-		send_simple_ipc(state.ipc_fd, SOSC_DEVICE_DISCONNECTION);
+				monome_get_serial(state->monome));
+	} else {
+		/* so that the supervisor's totals come out right */
+		send_device_stats(state);
+		send_simple_ipc(state->ipc_fd, SOSC_DEVICE_DISCONNECTION);
+	}
 
-	if( sosc_config_write(monome_get_serial(state.monome), &state) ) {
+	if( sosc_config_write(monome_get_serial(state->monome), state) ) {
 		fprintf(
 			stderr, "serialosc [%s]: couldn't write config :(\n",
-			monome_get_serial(state.monome));
+			monome_get_serial(state->monome));
 	}
 
-err_svc_name:
-	lo_address_free(state.outgoing);
-err_lo_addr:
-	lo_server_free(state.server);
-err_server_new:
-	s_free(state.config.app.osc_prefix);
-	s_free(state.config.app.host);
+	lo_address_free(state->outgoing);
+	lo_server_free(state->server);
+
+	osc_recv_free(state);
+	osc_free_event_templates(state);
+	s_free(state->config.app.osc_prefix);
+	s_free(state->config.app.host);
+}
+
+void sosc_server_run(monome_t *monome)
+{
+	sosc_state_t state = {
+		.monome = monome,
+		.ipc_fd = (!isatty(STDOUT_FILENO)) ? STDOUT_FILENO : -1
+	};
+
+	sosc_latency_catch_signal();
+
+	if( sosc_server_start(&state) )
+		return;
+
+	sosc_event_loop(&state);
+	sosc_server_stop(&state);
 }
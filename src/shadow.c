@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "serialosc.h"
+
+/* we don't know what's on the device at this position, so any write
+   has to go through. */
+#define LEVEL_UNKNOWN 0xFF
+
+/* sets the shadow up for a grid of the given size, with every LED in an
+   unknown state. called at startup and whenever the rotation changes,
+   since libmonome doesn't redraw the grid when it's rotated. */
+void sosc_shadow_init(sosc_shadow_t *shadow, int cols, int rows)
+{
+	shadow->cols = (cols > SOSC_MAX_GRID_SIZE) ? SOSC_MAX_GRID_SIZE : cols;
+	shadow->rows = (rows > SOSC_MAX_GRID_SIZE) ? SOSC_MAX_GRID_SIZE : rows;
+
+	memset(shadow->levels, LEVEL_UNKNOWN, sizeof(shadow->levels));
+}
+
+/* returns nonzero if any LED wasn't already at `level` */
+int sosc_shadow_fill(sosc_shadow_t *shadow, int level)
+{
+	int x, y, changed = 0;
+
+	for (y = 0; y < shadow->rows; y++)
+		for (x = 0; x < shadow->cols; x++)
+			changed |= sosc_shadow_update(shadow, x, y, level);
+
+	return changed;
+}
+
+/* returns nonzero if the LED at (x, y) wasn't already at `level`, or if
+   we can't tell. */
+int sosc_shadow_update(sosc_shadow_t *shadow, int x, int y, int level)
+{
+	uint8_t *cur;
+
+	if (x < 0 || y < 0 || x >= shadow->cols || y >= shadow->rows)
+		return 1;
+
+	cur = &shadow->levels[y][x];
+
+	/* leave it to libmonome to decide what an out-of-range level means */
+	if (level < 0 || level > 15) {
+		*cur = LEVEL_UNKNOWN;
+		return 1;
+	}
+
+	if (*cur == level)
+		return 0;
+
+	*cur = level;
+	return 1;
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "serialosc.h"
+#include "devices.h"
+
+/* a slot map. devices live in a growable array of slots, and unused
+   slots are kept on a free list, so adding and removing are O(1) and
+   nothing ever moves around underneath the poll loop.
+
+   a handle is the slot index in the low 32 bits and the slot's
+   generation in the high 32. removing a device bumps the generation, so
+   any handles to it left lying around stop resolving instead of
+   pointing at whatever gets the slot next.
+
+   lookup by fd is O(1), since it's what the poll loop does for every
+   message. lookups by serial and port only happen for OSC requests, and
+   just walk the table. */
+
+#define INITIAL_CAPACITY 16
+#define NO_SLOT -1
+
+#define HANDLE(t, i) \
+	(((sosc_dev_handle_t) (t)->slots[i].generation << 32) | (uint32_t) (i))
+#define HANDLE_INDEX(h) ((int) ((h) & 0xFFFFFFFF))
+#define HANDLE_GENERATION(h) ((uint32_t) ((h) >> 32))
+
+void sosc_devs_init(sosc_dev_table_t *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->free_head = NO_SLOT;
+}
+
+void sosc_devs_fini(sosc_dev_table_t *t)
+{
+	int i = -1;
+
+	while (sosc_devs_next(t, &i))
+		sosc_devs_remove(t, HANDLE(t, i));
+
+	s_free(t->slots);
+	s_free(t->by_fd);
+
+	sosc_devs_init(t);
+}
+
+static int grow_slots(sosc_dev_table_t *t)
+{
+	sosc_dev_slot_t *slots;
+	int i, capacity;
+
+	capacity = t->capacity ? t->capacity * 2 : INITIAL_CAPACITY;
+
+	if (!(slots = s_calloc(capacity, sizeof(*slots))))
+		return -1;
+
+	if (t->slots)
+		memcpy(slots, t->slots, t->capacity * sizeof(*slots));
+
+	/* the new slots go on the free list, lowest first */
+	for (i = capacity - 1; i >= t->capacity; i--) {
+		slots[i].generation = 1;
+		slots[i].next_free = t->free_head;
+		t->free_head = i;
+	}
+
+	s_free(t->slots);
+	t->slots = slots;
+	t->capacity = capacity;
+
+	return 0;
+}
+
+static int grow_by_fd(sosc_dev_table_t *t, int fd)
+{
+	int *by_fd;
+	int i, len;
+
+	for (len = t->by_fd_len ? t->by_fd_len : INITIAL_CAPACITY; len <= fd;
+	     len *= 2);
+
+	if (!(by_fd = s_malloc(len * sizeof(*by_fd))))
+		return -1;
+
+	if (t->by_fd)
+		memcpy(by_fd, t->by_fd, t->by_fd_len * sizeof(*by_fd));
+
+	for (i = t->by_fd_len; i < len; i++)
+		by_fd[i] = NO_SLOT;
+
+	s_free(t->by_fd);
+	t->by_fd = by_fd;
+	t->by_fd_len = len;
+
+	return 0;
+}
+
+sosc_dev_handle_t sosc_devs_add(sosc_dev_table_t *t, int fd)
+{
+	sosc_dev_slot_t *slot;
+	int i;
+
+	if (fd < 0)
+		return 0;
+
+	if (fd >= t->by_fd_len && grow_by_fd(t, fd))
+		return 0;
+
+	if (t->free_head == NO_SLOT && grow_slots(t))
+		return 0;
+
+	i = t->free_head;
+	slot = &t->slots[i];
+
+	t->free_head = slot->next_free;
+
+	memset(&slot->info, 0, sizeof(slot->info));
+	slot->info.fd = fd;
+	slot->in_use = 1;
+
+	t->by_fd[fd] = i;
+	t->count++;
+
+	return HANDLE(t, i);
+}
+
+sosc_device_info_t *sosc_devs_get(sosc_dev_table_t *t, sosc_dev_handle_t h)
+{
+	int i = HANDLE_INDEX(h);
+
+	if (!h || i >= t->capacity || !t->slots[i].in_use
+	    || t->slots[i].generation != HANDLE_GENERATION(h))
+		return NULL;
+
+	return &t->slots[i].info;
+}
+
+/* frees the device's strings, but leaves its fd alone */
+void sosc_devs_remove(sosc_dev_table_t *t, sosc_dev_handle_t h)
+{
+	sosc_dev_slot_t *slot;
+	int i = HANDLE_INDEX(h);
+
+	if (!sosc_devs_get(t, h))
+		return;
+
+	slot = &t->slots[i];
+
+	t->by_fd[slot->info.fd] = NO_SLOT;
+
+	s_free(slot->info.serial);
+	s_free(slot->info.friendly);
+	memset(&slot->info, 0, sizeof(slot->info));
+
+	slot->in_use = 0;
+	slot->generation++;
+
+	/* skip 0, so that handles never come out as 0 */
+	if (!slot->generation)
+		slot->generation = 1;
+
+	slot->next_free = t->free_head;
+	t->free_head = i;
+	t->count--;
+}
+
+sosc_dev_handle_t sosc_devs_by_fd(sosc_dev_table_t *t, int fd)
+{
+	if (fd < 0 || fd >= t->by_fd_len || t->by_fd[fd] == NO_SLOT)
+		return 0;
+
+	return HANDLE(t, t->by_fd[fd]);
+}
+
+sosc_dev_handle_t sosc_devs_by_serial(sosc_dev_table_t *t, const char *serial)
+{
+	sosc_device_info_t *dev;
+	int i = -1;
+
+	while ((dev = sosc_devs_next(t, &i)))
+		if (dev->serial && !strcmp(dev->serial, serial))
+			return HANDLE(t, i);
+
+	return 0;
+}
+
+sosc_dev_handle_t sosc_devs_by_port(sosc_dev_table_t *t, uint16_t port)
+{
+	sosc_device_info_t *dev;
+	int i = -1;
+
+	while ((dev = sosc_devs_next(t, &i)))
+		if (dev->port == port)
+			return HANDLE(t, i);
+
+	return 0;
+}
+
+sosc_device_info_t *sosc_devs_next(sosc_dev_table_t *t, int *i)
+{
+	while (++*i < t->capacity)
+		if (t->slots[*i].in_use)
+			return &t->slots[*i].info;
+
+	return NULL;
+}
@@ -0,0 +1,537 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* for pthread_setaffinity_np() */
+#else
+#define _POSIX_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <monome.h>
+
+#include "serialosc.h"
+#include "hosted.h"
+
+/* in single-process mode, rather than forking off a serialosc process for
+   each device, the supervisor runs every device's server itself.
+
+   each device still gets its own OSC server, and still reports to the
+   supervisor with the usual IPC messages. they just go down a pipe
+   within the one process instead of a child's stdout, so the supervisor
+   can't tell the difference.
+
+   by default the devices are driven from the supervisor's own poll()
+   loop. with worker threads, each new device is handed to whichever
+   worker has the fewest, and that worker's loop drives it from then on.
+
+   nothing is shared between threads while a device is running: its
+   sosc_state_t belongs to the one loop which drives it, and the
+   supervisor's state (the OSC server, notification list, and so on) is
+   only ever touched from the supervisor's thread. the exceptions are
+   starting and stopping a server, which read and write config files and
+   talk to zeroconf, and so are serialised with lifecycle_lock. */
+
+/* milliseconds a worker waits before trying poll() again after it fails */
+#define WORKER_BACKOFF 100
+
+typedef struct sosc_hosted {
+	sosc_state_t state;
+	struct sosc_hosted *next;
+} sosc_hosted_t;
+
+typedef struct {
+	sosc_hosted_t *devices;
+	int count;
+} sosc_hosted_list_t;
+
+typedef struct {
+	pthread_t thread;
+	int index;
+
+	/* the supervisor hands over new devices through `pending`, then
+	   writes a byte to wake[1] to get the worker's attention. */
+	int wake[2];
+
+	pthread_mutex_t lock;
+	sosc_hosted_t *pending;
+	int count;
+
+	/* set by sosc_hosted_fini(), which then wakes the worker up */
+	int stop;
+
+	sosc_hosted_list_t list;
+} sosc_worker_t;
+
+static pthread_mutex_t lifecycle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static sosc_hosted_config_t config;
+static sosc_worker_t *workers = NULL;
+static int nworkers = 0;
+
+/* devices driven from the supervisor's loop, when there are no workers */
+static sosc_hosted_list_t inline_list = {NULL, 0};
+
+/**
+ * device lifecycle
+ */
+
+static sosc_hosted_t *start(const char *devnode, int *ipc_fd)
+{
+	sosc_hosted_t *h;
+	monome_t *monome;
+	int pipefds[2];
+
+	if (!(monome = monome_open(devnode)))
+		return NULL;
+
+	if (!(h = s_calloc(1, sizeof(*h)))) {
+		fprintf(stderr, "sosc_hosted_start(): couldn't allocate memory\n");
+		goto err_calloc;
+	}
+
+	if (pipe(pipefds) < 0) {
+		perror("sosc_hosted_start() pipe");
+		goto err_pipe;
+	}
+
+	h->state.monome = monome;
+	h->state.ipc_fd = pipefds[1];
+
+	pthread_mutex_lock(&lifecycle_lock);
+
+	if (sosc_server_start(&h->state)) {
+		pthread_mutex_unlock(&lifecycle_lock);
+		goto err_start;
+	}
+
+	pthread_mutex_unlock(&lifecycle_lock);
+
+	*ipc_fd = pipefds[0];
+	return h;
+
+err_start:
+	close(pipefds[0]);
+	close(pipefds[1]);
+err_pipe:
+	s_free(h);
+err_calloc:
+	monome_close(monome);
+	return NULL;
+}
+
+static void stop(sosc_hosted_t *h)
+{
+	/* this sends SOSC_DEVICE_DISCONNECTION, and closing our end of the
+	   pipe afterwards lets the supervisor clean up as it would after a
+	   child process exited. */
+	pthread_mutex_lock(&lifecycle_lock);
+	sosc_server_stop(&h->state);
+	pthread_mutex_unlock(&lifecycle_lock);
+
+	close(h->state.ipc_fd);
+
+	monome_close(h->state.monome);
+	s_free(h);
+}
+
+/**
+ * driving a list of devices
+ *
+ * each device takes two pollfds: the serial port, then the OSC server.
+ */
+
+static int list_pollfds(sosc_hosted_list_t *list, struct pollfd *fds, int max)
+{
+	sosc_hosted_t *h;
+	int n = 0;
+
+	for (h = list->devices; h && n + 2 <= max; h = h->next) {
+		fds[n].fd = monome_get_fd(h->state.monome);
+		fds[n].events = POLLIN;
+		n++;
+
+		fds[n].fd = lo_server_get_socket_fd(h->state.server);
+		fds[n].events = POLLIN;
+		n++;
+	}
+
+	return n;
+}
+
+/* returns the number of devices which went away */
+static int list_handle(sosc_hosted_list_t *list, struct pollfd *fds, int nfds)
+{
+	sosc_hosted_t *h, **prev;
+	int n, gone = 0;
+
+	for (prev = &list->devices, n = 0; (h = *prev) && n + 2 <= nfds; n += 2) {
+		sosc_latency_woke(&h->state);
+
+		/* has the device gone away? */
+		if (fds[n].revents & (POLLHUP | POLLERR)) {
+			*prev = h->next;
+			list->count--;
+			gone++;
+
+			stop(h);
+			continue;
+		}
+
+		if (fds[n].revents & POLLIN)
+			sosc_server_drain_monome(&h->state);
+
+		if (fds[n + 1].revents & POLLIN)
+			sosc_server_drain_osc(&h->state);
+
+		prev = &h->next;
+	}
+
+	for (h = list->devices; h; h = h->next)
+		sosc_server_run_timers(&h->state);
+
+	return gone;
+}
+
+static int list_timeout(sosc_hosted_list_t *list)
+{
+	sosc_hosted_t *h;
+	int timeout, t;
+
+	for (timeout = -1, h = list->devices; h; h = h->next) {
+		if ((t = sosc_server_timeout(&h->state)) < 0)
+			continue;
+
+		if (timeout < 0 || t < timeout)
+			timeout = t;
+	}
+
+	return timeout;
+}
+
+static void list_add(sosc_hosted_list_t *list, sosc_hosted_t *h)
+{
+	h->next = list->devices;
+	list->devices = h;
+	list->count++;
+}
+
+static void list_stop(sosc_hosted_list_t *list)
+{
+	sosc_hosted_t *h, *next;
+
+	for (h = list->devices; h; h = next) {
+		next = h->next;
+		stop(h);
+	}
+
+	list->devices = NULL;
+	list->count = 0;
+}
+
+/**
+ * worker threads
+ */
+
+static void take_pending(sosc_worker_t *w)
+{
+	sosc_hosted_t *h, *next;
+	char buf[64];
+
+	while (read(w->wake[0], buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&w->lock);
+	h = w->pending;
+	w->pending = NULL;
+	pthread_mutex_unlock(&w->lock);
+
+	for (; h; h = next) {
+		next = h->next;
+		list_add(&w->list, h);
+	}
+}
+
+static int should_stop(sosc_worker_t *w)
+{
+	int stop;
+
+	pthread_mutex_lock(&w->lock);
+	stop = w->stop;
+	pthread_mutex_unlock(&w->lock);
+
+	return stop;
+}
+
+/* the devices are left running when the worker stops, for
+   sosc_hosted_fini() to deal with. */
+static void *worker_run(void *data)
+{
+	sosc_worker_t *w = data;
+	struct pollfd *fds = NULL;
+	int nalloc = 0, failing = 0, nfds, gone, i;
+
+	while (!should_stop(w)) {
+		/* the wakeup pipe, then two for each device */
+		if (nalloc < 1 + w->list.count * 2) {
+			s_free(fds);
+			nalloc = 1 + (w->list.count + 8) * 2;
+
+			if (!(fds = s_malloc(nalloc * sizeof(*fds)))) {
+				fprintf(stderr, "serialosc: worker %d out of memory\n",
+				        w->index);
+				return NULL;
+			}
+		}
+
+		fds[0].fd = w->wake[0];
+		fds[0].events = POLLIN;
+
+		nfds = 1 + list_pollfds(&w->list, fds + 1, nalloc - 1);
+
+		if (poll(fds, nfds, list_timeout(&w->list)) < 0) {
+			if (errno != EINTR) {
+				/* say so once, and don't spin if it keeps happening */
+				if (!failing++)
+					fprintf(stderr, "serialosc: worker %d: poll() failed: "
+					        "%s\n", w->index, strerror(errno));
+
+				poll(NULL, 0, WORKER_BACKOFF);
+				continue;
+			}
+
+			/* a signal (SIGUSR1, see src/latency.c) should still get
+			   the timers run, so carry on as if we'd timed out */
+			for (i = 0; i < nfds; i++)
+				fds[i].revents = 0;
+		}
+
+		failing = 0;
+
+		if ((gone = list_handle(&w->list, fds + 1, nfds - 1))) {
+			pthread_mutex_lock(&w->lock);
+			w->count -= gone;
+			pthread_mutex_unlock(&w->lock);
+		}
+
+		if (fds[0].revents & POLLIN)
+			take_pending(w);
+	}
+
+	s_free(fds);
+	return NULL;
+}
+
+static void tune_worker(sosc_worker_t *w)
+{
+	struct sched_param param;
+
+#ifdef __linux__
+	cpu_set_t cpus;
+	long ncpus;
+
+	if (config.pin && (ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->index % ncpus, &cpus);
+
+		if (pthread_setaffinity_np(w->thread, sizeof(cpus), &cpus))
+			fprintf(stderr, "serialosc: couldn't pin worker %d to cpu %ld\n",
+			        w->index, w->index % ncpus);
+	}
+#endif
+
+	if (config.fifo_priority > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = config.fifo_priority;
+
+		if (pthread_setschedparam(w->thread, SCHED_FIFO, &param))
+			fprintf(stderr, "serialosc: couldn't give worker %d SCHED_FIFO "
+			        "priority %d\n", w->index, config.fifo_priority);
+	}
+}
+
+/* if this fails, the workers which did start are left for
+   sosc_hosted_fini() to stop. */
+static int start_workers()
+{
+	sosc_worker_t *w;
+	int i;
+
+	if (!(workers = s_calloc(config.workers, sizeof(*workers))))
+		return -1;
+
+	for (i = 0; i < config.workers; i++) {
+		w = &workers[i];
+		w->index = i;
+
+		if (pipe(w->wake) < 0) {
+			perror("sosc_hosted_init() pipe");
+			return -1;
+		}
+
+		fcntl(w->wake[0], F_SETFL, O_NONBLOCK);
+		pthread_mutex_init(&w->lock, NULL);
+
+		if (pthread_create(&w->thread, NULL, worker_run, w)) {
+			fprintf(stderr, "sosc_hosted_init(): couldn't start worker %d\n", i);
+
+			pthread_mutex_destroy(&w->lock);
+			close(w->wake[0]);
+			close(w->wake[1]);
+			return -1;
+		}
+
+		tune_worker(w);
+		nworkers++;
+	}
+
+	return 0;
+}
+
+static void stop_workers()
+{
+	sosc_worker_t *w;
+	int i;
+
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_mutex_unlock(&w->lock);
+
+		if (write(w->wake[1], "", 1) < 0)
+			perror("sosc_hosted_fini() write");
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		pthread_join(w->thread, NULL);
+
+		/* including any which were handed over but never picked up */
+		take_pending(w);
+		list_stop(&w->list);
+
+		pthread_mutex_destroy(&w->lock);
+		close(w->wake[0]);
+		close(w->wake[1]);
+	}
+
+	s_free(workers);
+	workers = NULL;
+	nworkers = 0;
+}
+
+/* the worker with the fewest devices, so that one busy grid doesn't end
+   up sharing a thread with all the others. */
+static sosc_worker_t *least_loaded()
+{
+	sosc_worker_t *best = NULL;
+	int i, count, best_count = 0;
+
+	for (i = 0; i < config.workers; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		count = workers[i].count;
+		pthread_mutex_unlock(&workers[i].lock);
+
+		if (!best || count < best_count) {
+			best = &workers[i];
+			best_count = count;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * public
+ */
+
+int sosc_hosted_init(const sosc_hosted_config_t *c)
+{
+	config = *c;
+
+	if (config.workers > 0)
+		return start_workers();
+
+	return 0;
+}
+
+int sosc_hosted_start(const char *devnode)
+{
+	sosc_worker_t *w;
+	sosc_hosted_t *h;
+	int ipc_fd;
+
+	if (!(h = start(devnode, &ipc_fd)))
+		return -1;
+
+	if (!workers) {
+		list_add(&inline_list, h);
+		return ipc_fd;
+	}
+
+	w = least_loaded();
+
+	pthread_mutex_lock(&w->lock);
+	h->next = w->pending;
+	w->pending = h;
+	w->count++;
+	pthread_mutex_unlock(&w->lock);
+
+	if (write(w->wake[1], "", 1) < 0)
+		perror("sosc_hosted_start() write");
+
+	return ipc_fd;
+}
+
+/* stops the worker threads, and then every device which is still
+   running. called once the supervisor's loop has finished. */
+void sosc_hosted_fini()
+{
+	stop_workers();
+	list_stop(&inline_list);
+}
+
+/* the rest are for the supervisor's loop, and only do anything when
+   there are no worker threads. */
+
+int sosc_hosted_pollfds(struct pollfd *fds, int max)
+{
+	return list_pollfds(&inline_list, fds, max);
+}
+
+/* fds and nfds have to be what sosc_hosted_pollfds() filled in, and no
+   devices can have been started in between. */
+void sosc_hosted_handle(struct pollfd *fds, int nfds)
+{
+	list_handle(&inline_list, fds, nfds);
+}
+
+/* the poll() timeout which will wake us for the nearest deadline of any
+   device, or -1 if none of them have anything pending. */
+int sosc_hosted_timeout()
+{
+	return list_timeout(&inline_list);
+}
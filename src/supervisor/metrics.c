@@ -0,0 +1,569 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_SOURCE
+#define _C99_SOURCE /* OSX wants this for snprintf */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+#include "devices.h"
+#include "metrics.h"
+
+/* the supervisor's view of how everything's going, for hosts which run a
+   lot of grids and need one cheap place to look for trouble. devices
+   send their counters up over IPC (SOSC_DEVICE_STATS, see src/server.c),
+   and the supervisor adds its own: hotplugs, how long devices took to
+   spawn and then to come up, and how often they come back.
+
+   all of it can be had over OSC with /serialosc/stats, and with -m it's
+   also written out every so often as a prometheus text file.
+
+   like the rest of the supervisor, this is only ever touched from the
+   supervisor's own thread. */
+
+/* how often the metrics file gets rewritten, in microseconds */
+#define FILE_INTERVAL 5000000
+
+/* a device which hasn't reported for this long has gone quiet, so its
+   rates are zero rather than whatever they were when it stopped */
+#define IDLE_AFTER (2 * SOSC_STATS_REPORT_INTERVAL)
+
+#define STATS_FIELDS 6
+
+typedef struct sosc_seen_serial {
+	struct sosc_seen_serial *next;
+	char serial[];
+} sosc_seen_serial_t;
+
+static struct {
+	uint64_t started;
+
+	/* devices reported by the detector, and devices removed. a removal
+	   which isn't clean means the device's server went away without
+	   saying goodbye. */
+	uint64_t hotplugs;
+	uint64_t removals;
+	uint64_t lost;
+
+	uint64_t spawns;
+	uint64_t spawn_failures;
+	uint64_t spawn_us_total;
+	uint64_t spawn_us_max;
+
+	/* devices which came up, and how long after we started spawning
+	   them */
+	uint64_t readies;
+	uint64_t ready_us_total;
+	uint64_t ready_us_max;
+
+	/* devices which came up under a serial we'd already seen. the
+	   serials are kept around for as long as we run. */
+	uint64_t restarts;
+	sosc_seen_serial_t *seen;
+
+	/* the last word from devices which have since been removed, so that
+	   the totals don't go backwards */
+	sosc_ipc_stats_t departed;
+
+	const char *path;
+	uint64_t next_write;
+} metrics;
+
+static const struct {
+	const char *name;
+	const char *help;
+} stats_names[STATS_FIELDS] = {
+	{"input_events",        "Key, encoder and tilt events from devices."},
+	{"datagrams_received",  "OSC datagrams received by device servers."},
+	{"datagrams_sent",      "OSC datagrams sent by device servers."},
+	{"mext_handled",        "Device OSC messages handled."},
+	{"serial_bytes",        "Bytes written to devices."},
+	{"leds_skipped",        "LED writes dropped or coalesced."}
+};
+
+static void stats_vals(uint64_t *v, const sosc_ipc_stats_t *s)
+{
+	v[0] = s->input;
+	v[1] = s->datagrams_in;
+	v[2] = s->datagrams_out;
+	v[3] = s->mext_handled;
+	v[4] = s->serial_bytes;
+	v[5] = s->leds_skipped;
+}
+
+static void add_stats(sosc_ipc_stats_t *to, const sosc_ipc_stats_t *s)
+{
+	to->input         += s->input;
+	to->datagrams_in  += s->datagrams_in;
+	to->datagrams_out += s->datagrams_out;
+	to->mext_handled  += s->mext_handled;
+	to->serial_bytes  += s->serial_bytes;
+	to->leds_skipped  += s->leds_skipped;
+}
+
+static void total_stats(sosc_ipc_stats_t *total, sosc_dev_table_t *devs)
+{
+	sosc_device_info_t *dev;
+	int i = -1;
+
+	*total = metrics.departed;
+
+	while ((dev = sosc_devs_next(devs, &i)))
+		add_stats(total, &dev->metrics.last);
+}
+
+static void device_rates(sosc_ipc_stats_t *rate, sosc_device_info_t *dev,
+                         uint64_t now)
+{
+	if (now - dev->metrics.last_at > IDLE_AFTER)
+		memset(rate, 0, sizeof(*rate));
+	else
+		*rate = dev->metrics.rate;
+}
+
+static void count_devices(sosc_dev_table_t *devs, uint64_t *ready,
+                          uint64_t *starting)
+{
+	sosc_device_info_t *dev;
+	int i = -1;
+
+	*ready = *starting = 0;
+
+	while ((dev = sosc_devs_next(devs, &i))) {
+		if (dev->ready)
+			(*ready)++;
+		else
+			(*starting)++;
+	}
+}
+
+static uint64_t average(uint64_t total, uint64_t count)
+{
+	return (count) ? total / count : 0;
+}
+
+/**
+ * events
+ */
+
+void sosc_metrics_set_file(const char *path)
+{
+	metrics.path = path;
+}
+
+void sosc_metrics_init()
+{
+	metrics.started = metrics.next_write = sosc_monotonic_us();
+}
+
+void sosc_metrics_hotplug()
+{
+	metrics.hotplugs++;
+}
+
+/* dev is NULL if the spawn failed */
+void sosc_metrics_spawned(sosc_device_info_t *dev, uint64_t started)
+{
+	uint64_t took = sosc_monotonic_us() - started;
+
+	metrics.spawns++;
+
+	if (!dev) {
+		metrics.spawn_failures++;
+		return;
+	}
+
+	dev->metrics.spawned = started;
+
+	metrics.spawn_us_total += took;
+	if (took > metrics.spawn_us_max)
+		metrics.spawn_us_max = took;
+}
+
+void sosc_metrics_ready(sosc_device_info_t *dev)
+{
+	uint64_t took = sosc_monotonic_us() - dev->metrics.spawned;
+	sosc_seen_serial_t *s;
+
+	metrics.readies++;
+	metrics.ready_us_total += took;
+	if (took > metrics.ready_us_max)
+		metrics.ready_us_max = took;
+
+	if (!dev->serial)
+		return;
+
+	for (s = metrics.seen; s; s = s->next) {
+		if (!strcmp(s->serial, dev->serial)) {
+			metrics.restarts++;
+			return;
+		}
+	}
+
+	if (!(s = s_malloc(sizeof(*s) + strlen(dev->serial) + 1)))
+		return;
+
+	strcpy(s->serial, dev->serial);
+	s->next = metrics.seen;
+	metrics.seen = s;
+}
+
+void sosc_metrics_report(sosc_device_info_t *dev, const sosc_ipc_stats_t *s)
+{
+	uint64_t now, dt;
+
+	now = sosc_monotonic_us();
+
+	/* per second, since the last report */
+	if (dev->metrics.last_at && (dt = now - dev->metrics.last_at)) {
+#define RATE(f) \
+		dev->metrics.rate.f = (s->f - dev->metrics.last.f) * 1000000 / dt
+
+		RATE(input);
+		RATE(datagrams_in);
+		RATE(datagrams_out);
+		RATE(mext_handled);
+		RATE(serial_bytes);
+		RATE(leds_skipped);
+
+#undef RATE
+	}
+
+	dev->metrics.last = *s;
+	dev->metrics.last_at = now;
+}
+
+void sosc_metrics_removed(sosc_device_info_t *dev, int clean)
+{
+	metrics.removals++;
+
+	if (!clean)
+		metrics.lost++;
+
+	add_stats(&metrics.departed, &dev->metrics.last);
+}
+
+/**
+ * /serialosc/stats
+ *
+ * replies, all int64s:
+ *
+ *   /serialosc/stats/health    uptime (seconds), devices up, devices
+ *                              still starting
+ *   /serialosc/stats/hotplug   detected, removed, removed uncleanly
+ *   /serialosc/stats/spawn     spawns, failures, average and max us
+ *   /serialosc/stats/ready     devices which have ever come up,
+ *                              average and max us from spawn to
+ *                              ready
+ *   /serialosc/stats/restarts  devices up under a serial seen before
+ *
+ * then for each device which is up, its serial followed by its counters
+ * and their rates per second:
+ *
+ *   /serialosc/stats/device       s input, datagrams in, datagrams out,
+ *                                   mext handled, serial bytes, leds
+ *                                   skipped
+ *   /serialosc/stats/device/rate  s (the same)
+ *
+ * and the counters summed over every device there's ever been:
+ *
+ *   /serialosc/stats/total
+ */
+
+static void reply(sosc_sendq_t *q, const char *host, const char *port,
+                  const char *path, const char *serial, int count,
+                  const uint64_t *vals)
+{
+	lo_message msg;
+	int i;
+
+	if (!(msg = lo_message_new()))
+		return;
+
+	if (serial)
+		lo_message_add_string(msg, serial);
+
+	for (i = 0; i < count; i++)
+		lo_message_add_int64(msg, vals[i]);
+
+	osc_sendq_add(q, host, port, path, msg);
+	lo_message_free(msg);
+}
+
+void sosc_metrics_reply(sosc_sendq_t *q, const char *host, const char *port,
+                        sosc_dev_table_t *devs)
+{
+	sosc_ipc_stats_t s;
+	sosc_device_info_t *dev;
+	uint64_t v[STATS_FIELDS], now;
+	int i = -1;
+
+	now = sosc_monotonic_us();
+
+	v[0] = (now - metrics.started) / 1000000;
+	count_devices(devs, &v[1], &v[2]);
+	reply(q, host, port, "/serialosc/stats/health", NULL, 3, v);
+
+	v[0] = metrics.hotplugs;
+	v[1] = metrics.removals;
+	v[2] = metrics.lost;
+	reply(q, host, port, "/serialosc/stats/hotplug", NULL, 3, v);
+
+	v[0] = metrics.spawns;
+	v[1] = metrics.spawn_failures;
+	v[2] = average(metrics.spawn_us_total, metrics.spawns - metrics.spawn_failures);
+	v[3] = metrics.spawn_us_max;
+	reply(q, host, port, "/serialosc/stats/spawn", NULL, 4, v);
+
+	v[0] = metrics.readies;
+	v[1] = average(metrics.ready_us_total, metrics.readies);
+	v[2] = metrics.ready_us_max;
+	reply(q, host, port, "/serialosc/stats/ready", NULL, 3, v);
+
+	reply(q, host, port, "/serialosc/stats/restarts", NULL, 1,
+	      &metrics.restarts);
+
+	while ((dev = sosc_devs_next(devs, &i))) {
+		if (!dev->ready)
+			continue;
+
+		stats_vals(v, &dev->metrics.last);
+		reply(q, host, port, "/serialosc/stats/device", dev->serial,
+		      STATS_FIELDS, v);
+
+		device_rates(&s, dev, now);
+		stats_vals(v, &s);
+		reply(q, host, port, "/serialosc/stats/device/rate", dev->serial,
+		      STATS_FIELDS, v);
+	}
+
+	total_stats(&s, devs);
+	stats_vals(v, &s);
+	reply(q, host, port, "/serialosc/stats/total", NULL, STATS_FIELDS, v);
+
+	osc_sendq_flush(q);
+}
+
+/**
+ * metrics file
+ *
+ * prometheus' text exposition format, written to a temporary file and
+ * renamed into place so that nothing ever reads half of it.
+ */
+
+static void write_metric(FILE *f, const char *name, const char *type,
+                         const char *help, uint64_t val)
+{
+	fprintf(f, "# HELP serialosc_%s %s\n", name, help);
+	fprintf(f, "# TYPE serialosc_%s %s\n", name, type);
+	fprintf(f, "serialosc_%s %llu\n", name, (unsigned long long) val);
+}
+
+static void write_seconds(FILE *f, const char *name, const char *help,
+                          uint64_t total_us, uint64_t count, uint64_t max_us)
+{
+	fprintf(f, "# HELP serialosc_%s_seconds %s\n", name, help);
+	fprintf(f, "# TYPE serialosc_%s_seconds summary\n", name);
+	fprintf(f, "serialosc_%s_seconds_sum %.6f\n", name, total_us / 1e6);
+	fprintf(f, "serialosc_%s_seconds_count %llu\n", name,
+	        (unsigned long long) count);
+	fprintf(f, "# TYPE serialosc_%s_seconds_max gauge\n", name);
+	fprintf(f, "serialosc_%s_seconds_max %.6f\n", name, max_us / 1e6);
+}
+
+/* label values are quoted, so a serial with a backslash, quote or
+   newline in it mustn't be written out as it is. */
+static void write_label_value(FILE *f, const char *val)
+{
+	for (; *val; val++)
+		switch (*val) {
+		case '\\':
+			fputs("\\\\", f);
+			break;
+
+		case '"':
+			fputs("\\\"", f);
+			break;
+
+		case '\n':
+			fputs("\\n", f);
+			break;
+
+		default:
+			fputc(*val, f);
+			break;
+		}
+}
+
+static void write_device_sample(FILE *f, const char *name, const char *unit,
+                                const char *serial, uint64_t val)
+{
+	fprintf(f, "serialosc_device_%s_%s{serial=\"", name, unit);
+	write_label_value(f, serial);
+	fprintf(f, "\"} %llu\n", (unsigned long long) val);
+}
+
+static void write_metrics(FILE *f, sosc_dev_table_t *devs)
+{
+	sosc_ipc_stats_t s;
+	sosc_device_info_t *dev;
+	uint64_t v[STATS_FIELDS], ready, starting, now;
+	int i, j;
+
+	now = sosc_monotonic_us();
+	count_devices(devs, &ready, &starting);
+
+	write_metric(f, "uptime_seconds", "gauge",
+	             "Seconds since the supervisor started.",
+	             (now - metrics.started) / 1000000);
+
+	fprintf(f, "# HELP serialosc_devices Devices, by state.\n");
+	fprintf(f, "# TYPE serialosc_devices gauge\n");
+	fprintf(f, "serialosc_devices{state=\"ready\"} %llu\n",
+	        (unsigned long long) ready);
+	fprintf(f, "serialosc_devices{state=\"starting\"} %llu\n",
+	        (unsigned long long) starting);
+
+	write_metric(f, "hotplugs_total", "counter",
+	             "Devices reported by the detector.", metrics.hotplugs);
+	write_metric(f, "removals_total", "counter",
+	             "Devices removed.", metrics.removals);
+	write_metric(f, "lost_total", "counter",
+	             "Devices whose server went away without disconnecting.",
+	             metrics.lost);
+	write_metric(f, "spawns_total", "counter",
+	             "Device servers spawned.", metrics.spawns);
+	write_metric(f, "spawn_failures_total", "counter",
+	             "Device servers which failed to spawn.",
+	             metrics.spawn_failures);
+	write_metric(f, "restarts_total", "counter",
+	             "Devices which came up under a serial seen before.",
+	             metrics.restarts);
+
+	write_seconds(f, "spawn", "Time taken to spawn a device server.",
+	              metrics.spawn_us_total,
+	              metrics.spawns - metrics.spawn_failures,
+	              metrics.spawn_us_max);
+	write_seconds(f, "ready", "Time from spawning a device to it being ready.",
+	              metrics.ready_us_total, metrics.readies,
+	              metrics.ready_us_max);
+
+	total_stats(&s, devs);
+	stats_vals(v, &s);
+
+	for (i = 0; i < STATS_FIELDS; i++) {
+		fprintf(f, "# HELP serialosc_%s_total %s\n",
+		        stats_names[i].name, stats_names[i].help);
+		fprintf(f, "# TYPE serialosc_%s_total counter\n",
+		        stats_names[i].name);
+		fprintf(f, "serialosc_%s_total %llu\n",
+		        stats_names[i].name, (unsigned long long) v[i]);
+	}
+
+	for (i = 0; i < STATS_FIELDS; i++) {
+		fprintf(f, "# HELP serialosc_device_%s_total %s\n",
+		        stats_names[i].name, stats_names[i].help);
+		fprintf(f, "# TYPE serialosc_device_%s_total counter\n",
+		        stats_names[i].name);
+
+		for (j = -1; (dev = sosc_devs_next(devs, &j));) {
+			if (!dev->ready || !dev->serial)
+				continue;
+
+			stats_vals(v, &dev->metrics.last);
+			write_device_sample(f, stats_names[i].name, "total",
+			                    dev->serial, v[i]);
+		}
+	}
+
+	for (i = 0; i < STATS_FIELDS; i++) {
+		fprintf(f, "# HELP serialosc_device_%s_per_second %s\n",
+		        stats_names[i].name, stats_names[i].help);
+		fprintf(f, "# TYPE serialosc_device_%s_per_second gauge\n",
+		        stats_names[i].name);
+
+		for (j = -1; (dev = sosc_devs_next(devs, &j));) {
+			if (!dev->ready || !dev->serial)
+				continue;
+
+			device_rates(&s, dev, now);
+			stats_vals(v, &s);
+			write_device_sample(f, stats_names[i].name, "per_second",
+			                    dev->serial, v[i]);
+		}
+	}
+}
+
+static void write_file(sosc_dev_table_t *devs)
+{
+	char *tmp;
+	FILE *f;
+
+	if (!(tmp = s_asprintf("%s.tmp", metrics.path)))
+		return;
+
+	if (!(f = fopen(tmp, "w"))) {
+		perror("serialoscd: couldn't write metrics");
+		s_free(tmp);
+		return;
+	}
+
+	write_metrics(f, devs);
+
+	if (fclose(f) || rename(tmp, metrics.path))
+		perror("serialoscd: couldn't write metrics");
+
+	s_free(tmp);
+}
+
+/* milliseconds until the metrics file is next due, for use as a poll()
+   timeout. -1 if there isn't one. */
+int sosc_metrics_timeout()
+{
+	uint64_t now;
+
+	if (!metrics.path)
+		return -1;
+
+	now = sosc_monotonic_us();
+
+	if (now >= metrics.next_write)
+		return 0;
+
+	return (metrics.next_write - now + 999) / 1000;
+}
+
+void sosc_metrics_service(sosc_dev_table_t *devs)
+{
+	uint64_t now;
+
+	if (!metrics.path)
+		return;
+
+	now = sosc_monotonic_us();
+
+	if (now < metrics.next_write)
+		return;
+
+	write_file(devs);
+	metrics.next_write = now + FILE_INTERVAL;
+}
@@ -20,7 +20,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <poll.h>
 
@@ -29,17 +31,9 @@
 #include "serialosc.h"
 #include "ipc.h"
 #include "osc.h"
-
-#define ARRAY_LENGTH(x) (sizeof(x) / sizeof(*x))
-#define MAX_DEVICES 32
-
-typedef struct sosc_device_info {
-	int ready;
-
-	uint16_t port;
-	char *serial;
-	char *friendly;
-} sosc_device_info_t;
+#include "hosted.h"
+#include "devices.h"
+#include "metrics.h"
 
 static void disable_subproc_waiting() {
 	struct sigaction s;
@@ -85,16 +79,27 @@ static int spawn_server(const char *exec_path, const char *devnode)
 	return -1;
 }
 
-typedef struct {
-	int count;
-	sosc_device_info_t *info[MAX_DEVICES];
-} sosc_dev_datastore_t;
-
 #define MAX_NOTIFICATION_ENDPOINTS 32
 
+/* /serialosc/notify subscribes host:port to the next device addition or
+   removal, after which the subscription is dropped. adding a lease (in
+   seconds) as a third argument makes it persistent instead: it carries
+   on receiving notifications until the lease runs out, and sending the
+   same message again renews it. a lease of 0 cancels it.
+
+   each host:port only ever gets one entry, however many times it
+   subscribes, and its address is resolved once when it first does. */
+
 typedef struct {
 	char host[256];
 	char port[6];
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	/* 0 for one-shot subscriptions, otherwise when the lease runs out,
+	   in sosc_monotonic_us() time */
+	uint64_t expires;
 } sosc_notification_endpoint_t;
 
 typedef struct {
@@ -102,57 +107,172 @@ typedef struct {
 	sosc_notification_endpoint_t endpoints[MAX_NOTIFICATION_ENDPOINTS];
 } sosc_notifications_t;
 
-sosc_notifications_t notifications = {0};
+/* the supervisor's OSC server and everything its handlers touch only
+   ever get used from the supervisor's own thread. hosted devices, even
+   those on worker threads, only talk to it over their IPC pipes. */
+
+static sosc_notifications_t notifications = {0};
 
 static lo_server *srv;
 
+/* everything the supervisor sends goes out in bursts, see
+   src/osc/sendq.c */
+static sosc_sendq_t sendq;
+
 static int portstr(char *dest, int src) {
 	return snprintf(dest, 6, "%d", src);
 }
 
+static lo_message device_message(sosc_device_info_t *dev)
+{
+	lo_message msg;
+
+	if (!(msg = lo_message_new())) {
+		fprintf(stderr, "device_message(): couldn't allocate lo_message\n");
+		return NULL;
+	}
+
+	lo_message_add(msg, "ssi", dev->serial, dev->friendly, dev->port);
+	return msg;
+}
+
+static void send_device(const char *host, const char *port,
+                        const char *path, sosc_device_info_t *dev)
+{
+	lo_message msg;
+
+	if (!(msg = device_message(dev)))
+		return;
+
+	osc_sendq_add(&sendq, host, port, path, msg);
+	lo_message_free(msg);
+}
+
 OSC_HANDLER_FUNC(dsc_list_devices)
 {
-	sosc_dev_datastore_t *devs = user_data;
-	lo_address *dst;
+	sosc_dev_table_t *devs = user_data;
+	sosc_device_info_t *dev;
 	char port[6];
-	int i;
+	int i = -1;
 
 	portstr(port, argv[1]->i);
 
-	if (!(dst = lo_address_new(&argv[0]->s, port))) {
-		fprintf(stderr, "dsc_list_devices(): error in lo_address_new()\n");
-		return 1;
-	}
+	while ((dev = sosc_devs_next(devs, &i)))
+		if (dev->ready)
+			send_device(&argv[0]->s, port, "/serialosc/device", dev);
 
-	for (i = 0; i < devs->count; i++)
-		lo_send_from(dst, srv, LO_TT_IMMEDIATE, "/serialosc/device", "ssi",
-					 devs->info[i]->serial,
-					 devs->info[i]->friendly,
-					 devs->info[i]->port);
+	osc_sendq_flush(&sendq);
+	return 0;
+}
 
-	lo_address_free(dst);
+OSC_HANDLER_FUNC(dsc_stats)
+{
+	char port[6];
 
+	portstr(port, argv[1]->i);
+	sosc_metrics_reply(&sendq, &argv[0]->s, port, user_data);
 	return 0;
 }
 
-OSC_HANDLER_FUNC(add_notification_endpoint)
+static void remove_endpoint(int i)
+{
+	/* order doesn't matter, so just move the last one in */
+	notifications.endpoints[i] =
+		notifications.endpoints[--notifications.count];
+}
+
+static void expire_endpoints()
+{
+	uint64_t now = sosc_monotonic_us();
+	int i;
+
+	for (i = 0; i < notifications.count; i++) {
+		if (notifications.endpoints[i].expires
+		    && notifications.endpoints[i].expires <= now)
+			remove_endpoint(i--);
+	}
+}
+
+/* called once a round of notifications has gone out */
+static void drop_oneshot_endpoints()
+{
+	int i;
+
+	for (i = 0; i < notifications.count; i++)
+		if (!notifications.endpoints[i].expires)
+			remove_endpoint(i--);
+}
+
+static int find_endpoint(const char *host, const char *port)
+{
+	int i;
+
+	for (i = 0; i < notifications.count; i++)
+		if (!strcmp(notifications.endpoints[i].host, host)
+		    && !strcmp(notifications.endpoints[i].port, port))
+			return i;
+
+	return -1;
+}
+
+/* lease is in seconds. 0 means one-shot, and less than 0 cancels. */
+static int subscribe(const char *host, int portnum, int lease)
 {
 	sosc_notification_endpoint_t *n;
+	char port[6];
+	int i;
+
+	portstr(port, portnum);
+	expire_endpoints();
+
+	if ((i = find_endpoint(host, port)) >= 0) {
+		n = &notifications.endpoints[i];
+
+		if (lease < 0)
+			remove_endpoint(i);
+		else if (lease > 0)
+			n->expires = sosc_monotonic_us() + lease * 1000000ULL;
+
+		/* a one-shot subscription on top of a persistent one changes
+		   nothing */
+		return 0;
+	}
+
+	if (lease < 0)
+		return 0;
 
-	if (notifications.count >= MAX_NOTIFICATION_ENDPOINTS)
+	if (notifications.count >= MAX_NOTIFICATION_ENDPOINTS
+	    || strlen(host) >= sizeof(n->host))
 		return 1;
 
 	n = &notifications.endpoints[notifications.count];
 
-	portstr(n->port, argv[1]->i);
-	strncpy(n->host, &argv[0]->s, sizeof(n->host));
-	n->host[sizeof(n->host) - 1] = '\0';
+	if (osc_resolve(lo_server_get_socket_fd(srv), host, port,
+	                &n->addr, &n->addrlen)) {
+		fprintf(stderr, "serialoscd: couldn't resolve %s:%s\n", host, port);
+		return 1;
+	}
+
+	strcpy(n->host, host);
+	strcpy(n->port, port);
+	n->expires = lease ? sosc_monotonic_us() + lease * 1000000ULL : 0;
 
 	notifications.count++;
 	return 0;
 }
 
-static lo_server *setup_osc_server(sosc_dev_datastore_t *devs)
+OSC_HANDLER_FUNC(add_notification_endpoint)
+{
+	return subscribe(&argv[0]->s, argv[1]->i, 0);
+}
+
+OSC_HANDLER_FUNC(add_persistent_notification_endpoint)
+{
+	return subscribe(&argv[0]->s, argv[1]->i,
+	                 (argv[2]->i > 0) ? argv[2]->i : -1);
+}
+
+static lo_server *setup_osc_server(sosc_dev_table_t *devs)
 {
 	lo_server *srv;
 
@@ -161,15 +281,20 @@ static lo_server *setup_osc_server(sosc_dev_datastore_t *devs)
 
 	lo_server_add_method(
 		srv, "/serialosc/list", "si", dsc_list_devices, devs);
+	lo_server_add_method(
+		srv, "/serialosc/stats", "si", dsc_stats, devs);
 	lo_server_add_method(
 		srv, "/serialosc/notify", "si", add_notification_endpoint, devs);
+	lo_server_add_method(
+		srv, "/serialosc/notify", "sii",
+		add_persistent_notification_endpoint, devs);
 
 	return srv;
 }
 
 static int notify(sosc_ipc_type_t type, sosc_device_info_t *dev)
 {
-	lo_address dst;
+	lo_message msg;
 	char *path;
 	int i;
 
@@ -186,168 +311,288 @@ static int notify(sosc_ipc_type_t type, sosc_device_info_t *dev)
 		return 1;
 	}
 
-	for (i = 0; i < notifications.count; i++) {
-		if (!(dst = lo_address_new(
-		            notifications.endpoints[i].host,
-		            notifications.endpoints[i].port))) {
-			fprintf(stderr, "notify(): couldn't allocate lo_address\n");
-			continue;
-		}
+	expire_endpoints();
 
-		lo_send_from(dst, srv, LO_TT_IMMEDIATE, path, "ssi",
-		             dev->serial, dev->friendly, dev->port);
+	if (!(msg = device_message(dev)))
+		return 1;
 
-		lo_address_free(dst);
-	}
+	for (i = 0; i < notifications.count; i++)
+		osc_sendq_add_addr(&sendq, &notifications.endpoints[i].addr,
+		                   notifications.endpoints[i].addrlen, path, msg);
 
+	lo_message_free(msg);
+	osc_sendq_flush(&sendq);
 	return 0;
 }
 
-static void read_detector_msgs(const char *progname, int fd)
+/* clean if the device said it was disconnecting, rather than just
+   going away */
+static int remove_device(sosc_dev_table_t *devs, sosc_dev_handle_t h,
+                         int clean)
 {
-	sosc_dev_datastore_t devs = {
-		0, {[0 ... MAX_DEVICES - 1] = NULL}
-	};
-	struct pollfd fds[MAX_DEVICES + 2];
-	sosc_ipc_msg_t msg;
-	int child_fd, i, notified;
+	sosc_device_info_t *dev = sosc_devs_get(devs, h);
+	int notified = 0;
 
-#define FD_COUNT (devs.count + 2)
-#define MONITOR_FD 1
-#define DEVINDEX(x) (x + 2)
+	sosc_metrics_removed(dev, clean);
 
-	disable_subproc_waiting();
+	if (dev->ready) {
+		fprintf(stderr, "serialosc [%s]: disconnected, exiting\n",
+				dev->serial);
 
-	if (!(srv = setup_osc_server(&devs))) {
-		perror("couldn't init OSC server");
+		notify(SOSC_DEVICE_DISCONNECTION, dev);
+		notified = 1;
+	}
+
+	close(dev->fd);
+	sosc_devs_remove(devs, h);
+
+	return notified;
+}
+
+static void add_device(sosc_dev_table_t *devs, const char *progname,
+                       const sosc_hosted_config_t *hosted, char *devnode)
+{
+	sosc_dev_handle_t h;
+	uint64_t started;
+	int child_fd;
+
+	sosc_metrics_hotplug();
+	started = sosc_monotonic_us();
+
+	if (hosted)
+		child_fd = sosc_hosted_start(devnode);
+	else
+		child_fd = spawn_server(progname, devnode);
+
+	s_free(devnode);
+
+	if (child_fd < 1) {
+		perror("read_detector_msgs: spawn");
+		sosc_metrics_spawned(NULL, started);
+		return;
+	}
+
+	/* so that a device which only sends half a message can't hold up
+	   the rest. see sosc_ipc_reader_fill(). */
+	fcntl(child_fd, F_SETFL, O_NONBLOCK);
+
+	if (!(h = sosc_devs_add(devs, child_fd))) {
+		fprintf(stderr, "read_detector_msgs(): couldn't add device\n");
+		sosc_metrics_spawned(NULL, started);
+		close(child_fd);
 		return;
 	}
 
-	fds[0].fd = lo_server_get_socket_fd(srv);
-	fds[0].events = POLLIN;
+	sosc_metrics_spawned(sosc_devs_get(devs, h), started);
+}
 
-	fds[MONITOR_FD].fd     = fd;
-	fds[MONITOR_FD].events = POLLIN;
+/* handles activity on a device's IPC pipe. returns 1 if anybody was
+   notified about it. */
+static int handle_device(sosc_dev_table_t *devs, struct pollfd *pfd)
+{
+	sosc_device_info_t *dev;
+	sosc_dev_handle_t h;
+	sosc_ipc_msg_t msg;
+	int gone, ret, notified = 0;
 
-	do {
-		notified = 0;
+	if (!(dev = sosc_devs_get(devs, (h = sosc_devs_by_fd(devs, pfd->fd)))))
+		return 0;
+
+	/* on a hangup, there may still be messages waiting (i.e. the
+	   disconnection itself), and reading gets us those before it tells
+	   us the other end is gone. */
+	gone = sosc_ipc_reader_fill(&dev->reader, pfd->fd) < 0;
+
+	while ((ret = sosc_ipc_reader_next(&dev->reader, &msg)) > 0) {
+		switch (msg.type) {
+		case SOSC_OSC_PORT_CHANGE:
+			dev->port = msg.port_change.port;
+			break;
 
-		if (poll(fds, FD_COUNT, -1) < 0) {
-			perror("read_detector_msgs() poll");
+		case SOSC_DEVICE_INFO:
+			s_free(dev->serial);
+			s_free(dev->friendly);
+
+			dev->serial = msg.device_info.serial;
+			dev->friendly = msg.device_info.friendly;
+			break;
+
+		case SOSC_DEVICE_READY:
+			dev->ready = 1;
+
+			fprintf(stderr, "serialosc [%s]: connected, server running on port %d\n",
+					dev->serial, dev->port);
+
+			sosc_metrics_ready(dev);
+			notify(SOSC_DEVICE_CONNECTION, dev);
+			notified = 1;
+			break;
+
+		case SOSC_DEVICE_STATS:
+			sosc_metrics_report(dev, &msg.stats);
+			break;
+
+		case SOSC_DEVICE_DISCONNECTION:
+			return notified | remove_device(devs, h, 1);
+
+		case SOSC_DEVICE_CONNECTION:
+			s_free(msg.connection.devnode);
+			break;
+
+		default:
 			break;
 		}
+	}
 
-		if (fds[0].revents & POLLIN )
-			lo_server_recv_noblock(srv, 0);
+	if (ret < 0) {
+		fprintf(stderr, "read_detector_msgs(): bad message from device\n");
+		gone = 1;
+	}
 
-		for (i = 1; i < FD_COUNT; i++) {
-			if (fds[i].revents & POLLERR || fds[i].revents & POLLHUP) {
-				if (i == MONITOR_FD) {
-					puts("serialoscd: monitor process disappeared, bailing out!");
-					return;
-				} else
-					if (devs.info[i - 2]->ready)
-						goto disconnect_known;
-					else
-						goto disconnect_unknown;
-			}
+	if (gone)
+		notified |= remove_device(devs, h, 0);
 
-			if (!(fds[i].revents & POLLIN))
-				continue;
+	return notified;
+}
 
-			if (sosc_ipc_msg_read(fds[i].fd, &msg) < 0)
-				continue;
+/* the sooner of two poll() timeouts, where -1 is never */
+static int sooner(int a, int b)
+{
+	if (a < 0 || b < 0)
+		return (a < 0) ? b : a;
 
-			switch (msg.type) {
-			case SOSC_DEVICE_CONNECTION:
-				if (devs.count >= ARRAY_LENGTH(fds)) {
-					s_free((char *) msg.connection.devnode);
-					fprintf(stderr,
-							"read_detector_msgs(): too many monomes\n");
+	return (a < b) ? a : b;
+}
 
-					s_free(msg.connection.devnode);
-					continue;
-				}
+static void read_detector_msgs(const char *progname, int fd,
+                               const sosc_hosted_config_t *hosted)
+{
+	sosc_device_info_t *dev;
+	sosc_dev_table_t devs;
+	sosc_ipc_reader_t monitor;
+	struct pollfd *fds = NULL;
+	sosc_ipc_msg_t msg;
+	int i, ret, notified, nalloc, nfds, hosted_fds, timeout;
 
-				child_fd = spawn_server(progname, msg.connection.devnode);
-				s_free(msg.connection.devnode);
+#define MONITOR_FD 1
 
-				if (child_fd < 1) {
-					perror("read_detector_msgs: spawn");
-					continue;
-				}
+	disable_subproc_waiting();
+	sosc_devs_init(&devs);
 
-				if (!(devs.info[devs.count] = s_calloc(1, sizeof(*devs.info[devs.count])))) {
-					fprintf(stderr, "calloc failed!\n");
-					continue;
-				}
+	sosc_ipc_reader_init(&monitor);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
 
-				fds[DEVINDEX(devs.count)].fd = child_fd;
-				fds[DEVINDEX(devs.count)].events = POLLIN;
+	if (!(srv = setup_osc_server(&devs))) {
+		perror("couldn't init OSC server");
+		return;
+	}
 
-				devs.count++;
+	osc_sendq_init(&sendq, lo_server_get_socket_fd(srv));
+	sosc_metrics_init();
+	nalloc = 0;
 
-				break;
+	do {
+		notified = 0;
 
-			case SOSC_OSC_PORT_CHANGE:
-				devs.info[i - 2]->port = msg.port_change.port;
-				break;
+		/* the OSC server, the detector, and a pipe for each device. in
+		   single-process mode, the serial port and OSC server of each
+		   hosted device go on the end. */
+		if (nalloc < 2 + devs.count * 3) {
+			s_free(fds);
+			nalloc = 2 + (devs.count + 8) * 3;
 
-			case SOSC_DEVICE_INFO:
-				devs.info[i - 2]->serial = msg.device_info.serial;
-				devs.info[i - 2]->friendly = msg.device_info.friendly;
+			if (!(fds = s_malloc(nalloc * sizeof(*fds)))) {
+				fprintf(stderr, "read_detector_msgs(): out of memory\n");
 				break;
+			}
+		}
+
+		fds[0].fd = lo_server_get_socket_fd(srv);
+		fds[0].events = POLLIN;
 
-			case SOSC_DEVICE_READY:
-				devs.info[i - 2]->ready = 1;
+		fds[MONITOR_FD].fd     = fd;
+		fds[MONITOR_FD].events = POLLIN;
 
-				fprintf(stderr, "serialosc [%s]: connected, server running on port %d\n",
-						devs.info[i - 2]->serial, devs.info[i - 2]->port);
+		for (nfds = 2, i = -1; (dev = sosc_devs_next(&devs, &i)); nfds++) {
+			fds[nfds].fd = dev->fd;
+			fds[nfds].events = POLLIN;
+		}
 
-				notify(SOSC_DEVICE_CONNECTION, devs.info[i - 2]);
-				notified = 1;
+		hosted_fds = nfds;
+
+		if (hosted)
+			nfds += sosc_hosted_pollfds(&fds[hosted_fds], nalloc - hosted_fds);
+
+		timeout = sosc_metrics_timeout();
+		if (hosted)
+			timeout = sooner(timeout, sosc_hosted_timeout());
+
+		if (poll(fds, nfds, timeout) < 0) {
+			if (errno != EINTR) {
+				perror("read_detector_msgs() poll");
 				break;
+			}
+
+			/* a signal (SIGUSR1, see src/latency.c) should still get
+			   hosted devices' timers run, so carry on as if we'd timed
+			   out */
+			for (i = 0; i < nfds; i++)
+				fds[i].revents = 0;
+		}
 
-disconnect_known:
-			case SOSC_DEVICE_DISCONNECTION:
-				fprintf(stderr, "serialosc [%s]: disconnected, exiting\n",
-						devs.info[i - 2]->serial);
+		if (hosted)
+			sosc_hosted_handle(&fds[hosted_fds], nfds - hosted_fds);
 
-				notify(SOSC_DEVICE_DISCONNECTION, devs.info[i - 2]);
-				notified = 1;
+		if (fds[0].revents & POLLIN )
+			lo_server_recv_noblock(srv, 0);
 
-disconnect_unknown:
-				/* close the fd and free the devinfo struct */
-				close(fds[i].fd);
-				s_free(devs.info[i - 2]->serial);
-				s_free(devs.info[i - 2]->friendly);
-				s_free(devs.info[i - 2]);
+		/* devices are looked up by fd, so removing one as we go doesn't
+		   disturb the rest. */
+		for (i = 2; i < hosted_fds; i++)
+			if (fds[i].revents)
+				notified |= handle_device(&devs, &fds[i]);
 
-				/* shift everything in the array down by one */
-				memmove(&fds[i], &fds[i + 1], (devs.count - i + 1) * sizeof(*fds));
-				memmove(&devs.info[i - 2], &devs.info[i - 1],
-						(devs.count - i + 1) * sizeof(*devs.info));
-				devs.count--;
+		if (fds[MONITOR_FD].revents) {
+			if (sosc_ipc_reader_fill(&monitor, fd) < 0) {
+				puts("serialoscd: monitor process disappeared, bailing out!");
+				break;
+			}
 
-				/* and since fds[i + 1] has become fds[i], we'll
-				   repeat this iteration of the for() loop */
-				i--;
+			while ((ret = sosc_ipc_reader_next(&monitor, &msg)) > 0) {
+				if (msg.type == SOSC_DEVICE_CONNECTION)
+					add_device(&devs, progname, hosted,
+					           msg.connection.devnode);
+				else if (msg.type == SOSC_DEVICE_INFO) {
+					s_free(msg.device_info.serial);
+					s_free(msg.device_info.friendly);
+				}
+			}
 
+			if (ret < 0) {
+				puts("serialoscd: garbage from the monitor process, bailing out!");
 				break;
 			}
 		}
 
 		if (notified)
-			notifications.count = 0;
+			drop_oneshot_endpoints();
+
+		sosc_metrics_service(&devs);
 	} while (1);
+
+	s_free(fds);
 }
 
-int sosc_supervisor_run(char *progname)
+static int run(char *progname, const sosc_hosted_config_t *hosted)
 {
 	int pipefds[2];
 
 	sosc_config_create_directory();
 
+	/* so that SIGUSR1, meant for hosted devices or sent to every
+	   serialosc process at once, doesn't kill us */
+	sosc_latency_catch_signal();
+
 	if (pipe(pipefds) < 0) {
 		perror("sosc_supervisor_run() pipe");
 		return 0;
@@ -365,7 +610,20 @@ int sosc_supervisor_run(char *progname)
 
 	default:
 		close(pipefds[1]);
-		read_detector_msgs(progname, pipefds[0]);
+
+		/* only now that the detector has been forked off can we start
+		   any worker threads. */
+		if (hosted && sosc_hosted_init(hosted)) {
+			fprintf(stderr, "serialoscd: couldn't start worker threads\n");
+			sosc_hosted_fini();
+			return 1;
+		}
+
+		read_detector_msgs(progname, pipefds[0], hosted);
+
+		if (hosted)
+			sosc_hosted_fini();
+
 		return 0;
 	}
 
@@ -378,3 +636,15 @@ int sosc_supervisor_run(char *progname)
 	return 0;
 }
 
+int sosc_supervisor_run(char *progname)
+{
+	return run(progname, NULL);
+}
+
+/* runs every device's server inside this process rather than spawning
+   one per device. see src/supervisor/hosted.c */
+int sosc_supervisor_run_hosted(char *progname,
+                               const sosc_hosted_config_t *config)
+{
+	return run(progname, config);
+}
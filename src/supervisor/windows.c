@@ -35,7 +35,9 @@
 
 #define ARRAY_LENGTH(x)  (sizeof(x) / sizeof(*x))
 
-#define PIPE_BUF         128
+/* messages on the pipes aren't framed, but the same limit applies. one
+   which didn't fit in the read buffer would fail with ERROR_MORE_DATA. */
+#define PIPE_BUF         SOSC_IPC_MAX_FRAME
 #define SOSC_DEVICE_PIPE (SOSC_PIPE_PREFIX "devices")
 
 #define MAX_NOTIFICATION_ENDPOINTS 32
@@ -434,6 +436,10 @@ static int handle_msg(struct incoming_pipe *p, sosc_ipc_msg_t *msg)
 	case SOSC_OSC_PORT_CHANGE:
 		p->info.port = msg->port_change.port;
 		break;
+
+	case SOSC_DEVICE_STATS:
+		/* only the posix supervisor keeps metrics */
+		break;
 	}
 
 	return 0;
@@ -0,0 +1,399 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "virtual_monome.h"
+
+/* end-to-end latency through a serialosc server, measured against a
+   virtual device on a pty:
+
+     input:  a key press (or encoder turn) written to the serial port,
+             until its /grid/key (/enc/delta) datagram arrives
+     output: a /grid/led/set (/ring/set) datagram sent to the server,
+             until the LED command arrives at the serial port
+
+   each is run at several event rates, and we print percentiles of the
+   latencies for each. */
+
+#define DEFAULT_COUNT 2000
+#define DRAIN_TIMEOUT 500000
+
+/* every event in a run gets one of these slots, which encodes it
+   uniquely in both directions, so events can be in flight at once. */
+#define SLOTS 256
+
+typedef struct {
+	pthread_mutex_t lock;
+
+	/* when the event in each slot went out, or 0 */
+	uint64_t sent[SLOTS];
+
+	uint64_t *samples;
+	int count;
+	int max;
+} run_t;
+
+typedef struct {
+	sosc_vdev_t dev;
+	lo_server app;
+	lo_address server;
+
+	int port_acked;
+
+	run_t run;
+} bench_t;
+
+static const int default_rates[] = {100, 1000, 5000};
+
+/**
+ * bookkeeping
+ */
+
+static void run_reset(run_t *r, int max)
+{
+	pthread_mutex_lock(&r->lock);
+	memset(r->sent, 0, sizeof(r->sent));
+	r->count = 0;
+	r->max = max;
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void run_sent(run_t *r, int slot, uint64_t when)
+{
+	pthread_mutex_lock(&r->lock);
+	r->sent[slot] = when;
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void run_arrived(run_t *r, int slot, uint64_t when)
+{
+	pthread_mutex_lock(&r->lock);
+
+	if (r->sent[slot] && r->count < r->max)
+		r->samples[r->count++] = when - r->sent[slot];
+
+	r->sent[slot] = 0;
+	pthread_mutex_unlock(&r->lock);
+}
+
+static int run_count(run_t *r)
+{
+	int count;
+
+	pthread_mutex_lock(&r->lock);
+	count = r->count;
+	pthread_mutex_unlock(&r->lock);
+
+	return count;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, int count, int per_mille)
+{
+	int i = (count * per_mille) / 1000;
+	return sorted[(i < count) ? i : count - 1];
+}
+
+static void print_run(const char *what, int rate, int sent, run_t *r)
+{
+	int count = run_count(r);
+
+	if (!count) {
+		printf("  %-14s %8d %8d %6d %8s %8s %8s %8s\n",
+		       what, rate, 0, sent, "-", "-", "-", "-");
+		return;
+	}
+
+	qsort(r->samples, count, sizeof(*r->samples), compare_u64);
+
+	printf("  %-14s %8d %8d %6d %8llu %8llu %8llu %8llu\n",
+	       what, rate, count, sent - count,
+	       (unsigned long long) percentile(r->samples, count, 500),
+	       (unsigned long long) percentile(r->samples, count, 990),
+	       (unsigned long long) percentile(r->samples, count, 999),
+	       (unsigned long long) r->samples[count - 1]);
+}
+
+/**
+ * the application end
+ */
+
+static int grid_key_handler(const char *path, const char *types,
+                            lo_arg **argv, int argc, lo_message msg,
+                            void *user_data)
+{
+	bench_t *b = user_data;
+	int slot = ((argv[2]->i) ? 0 : 128) + (argv[1]->i % 8) * 16
+		+ (argv[0]->i % 16);
+
+	run_arrived(&b->run, slot, sosc_monotonic_us());
+	return 0;
+}
+
+static int enc_delta_handler(const char *path, const char *types,
+                             lo_arg **argv, int argc, lo_message msg,
+                             void *user_data)
+{
+	bench_t *b = user_data;
+	int slot = (argv[0]->i % 4) * 64 + ((argv[1]->i - 1) & 63);
+
+	run_arrived(&b->run, slot, sosc_monotonic_us());
+	return 0;
+}
+
+static int sys_port_handler(const char *path, const char *types,
+                            lo_arg **argv, int argc, lo_message msg,
+                            void *user_data)
+{
+	bench_t *b = user_data;
+
+	if (argv[0]->i == lo_server_get_port(b->app))
+		b->port_acked = 1;
+
+	return 0;
+}
+
+static int ignore_handler(const char *path, const char *types,
+                          lo_arg **argv, int argc, lo_message msg,
+                          void *user_data)
+{
+	return 0;
+}
+
+/* LED commands arriving at the device, on the device thread */
+static void device_cb(sosc_vdev_t *v, const uint8_t *msg, size_t len,
+                      uint64_t when, void *data)
+{
+	bench_t *b = data;
+
+	switch (msg[0]) {
+	case 0x10: /* led off */
+	case 0x11: /* led on */
+		run_arrived(&b->run, ((msg[0] & 1) ? 0 : 128)
+		            + (msg[2] % 8) * 16 + (msg[1] % 16), when);
+		break;
+
+	case 0x90: /* ring set */
+		run_arrived(&b->run, (msg[1] % 4) * 64 + (msg[2] & 63), when);
+		break;
+	}
+}
+
+/* dispatch whatever comes in to the application until `until` */
+static void recv_until(bench_t *b, uint64_t until)
+{
+	uint64_t now;
+
+	while ((now = sosc_monotonic_us()) < until)
+		lo_server_recv_noblock(b->app, (until - now > 1000) ? 1 : 0);
+}
+
+static int point_server_at_app(bench_t *b)
+{
+	uint64_t give_up = sosc_monotonic_us() + 1000000;
+
+	lo_send(b->server, "/sys/port", "i", lo_server_get_port(b->app));
+
+	while (!b->port_acked && sosc_monotonic_us() < give_up)
+		lo_server_recv_noblock(b->app, 10);
+
+	return !b->port_acked;
+}
+
+/**
+ * runs
+ */
+
+static void send_event(bench_t *b, int output, int slot)
+{
+	int arc = b->dev.arc;
+
+	run_sent(&b->run, slot, sosc_monotonic_us());
+
+	if (!output) {
+		if (arc)
+			sosc_vdev_enc(&b->dev, slot / 64, (slot % 64) + 1);
+		else
+			sosc_vdev_key(&b->dev, slot % 16, (slot / 16) % 8, slot < 128);
+	} else {
+		if (arc)
+			lo_send(b->server, "/monome/ring/set", "iii",
+			        slot / 64, slot % 64, 15);
+		else
+			lo_send(b->server, "/monome/grid/led/set", "iii",
+			        slot % 16, (slot / 16) % 8, slot < 128);
+	}
+}
+
+static void measure(bench_t *b, int output, int rate, int count)
+{
+	uint64_t start, interval, give_up;
+	int i;
+
+	run_reset(&b->run, count);
+
+	/* the server skips LED writes which wouldn't change anything, so
+	   start from a known state */
+	if (output && !b->dev.arc) {
+		lo_send(b->server, "/monome/grid/led/all", "i", 0);
+		recv_until(b, sosc_monotonic_us() + 10000);
+	}
+
+	interval = 1000000 / rate;
+	start = sosc_monotonic_us();
+
+	for (i = 0; i < count; i++) {
+		recv_until(b, start + i * interval);
+		send_event(b, output, i % SLOTS);
+	}
+
+	give_up = sosc_monotonic_us() + DRAIN_TIMEOUT;
+
+	while (run_count(&b->run) < count && sosc_monotonic_us() < give_up)
+		recv_until(b, sosc_monotonic_us() + 1000);
+}
+
+static void print_usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-a] [-n count] [rate ...]\n"
+	        "  -a        emulate an arc rather than a grid\n"
+	        "  -n count  events per rate (default %d)\n"
+	        "  rate      events per second (default 100 1000 5000)\n",
+	        progname, DEFAULT_COUNT);
+}
+
+int main(int argc, char **argv)
+{
+	int arc = 0, count = DEFAULT_COUNT, nrates, i, opt;
+	const int *rates;
+	int *arg_rates = NULL;
+	char port[6];
+	bench_t b;
+
+	while ((opt = getopt(argc, argv, "an:")) != -1) {
+		switch (opt) {
+		case 'a':
+			arc = 1;
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			break;
+
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (count < 1) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc) {
+		nrates = argc - optind;
+
+		if (!(arg_rates = s_calloc(nrates, sizeof(*arg_rates))))
+			return EXIT_FAILURE;
+
+		for (i = 0; i < nrates; i++)
+			if ((arg_rates[i] = atoi(argv[optind + i])) < 1) {
+				print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+
+		rates = arg_rates;
+	} else {
+		rates = default_rates;
+		nrates = sizeof(default_rates) / sizeof(*default_rates);
+	}
+
+	memset(&b, 0, sizeof(b));
+	pthread_mutex_init(&b.run.lock, NULL);
+
+	if (!(b.run.samples = s_calloc(count, sizeof(*b.run.samples))))
+		return EXIT_FAILURE;
+
+	if (sosc_vdev_open(&b.dev, arc, device_cb, &b))
+		return EXIT_FAILURE;
+
+	sosc_port_itos(port, sosc_vdev_port(&b.dev));
+
+	if (!(b.app = lo_server_new(NULL, NULL))
+	    || !(b.server = lo_address_new("127.0.0.1", port))) {
+		fprintf(stderr, "%s: couldn't set up OSC\n", argv[0]);
+		goto err;
+	}
+
+	lo_server_add_method(b.app, "/monome/grid/key", "iii",
+	                     grid_key_handler, &b);
+	lo_server_add_method(b.app, "/monome/enc/delta", "ii",
+	                     enc_delta_handler, &b);
+	lo_server_add_method(b.app, "/sys/port", "i", sys_port_handler, &b);
+	lo_server_add_method(b.app, NULL, NULL, ignore_handler, &b);
+
+	if (point_server_at_app(&b)) {
+		fprintf(stderr, "%s: the server never answered /sys/port\n", argv[0]);
+		goto err;
+	}
+
+	printf("latencies in microseconds, %d events per rate\n\n", count);
+	printf("  %-14s %8s %8s %6s %8s %8s %8s %8s\n",
+	       "", "rate/s", "samples", "lost", "p50", "p99", "p99.9", "max");
+
+	for (i = 0; i < nrates; i++) {
+		measure(&b, 0, rates[i], count);
+		print_run((arc) ? "enc -> osc" : "key -> osc", rates[i], count,
+		          &b.run);
+
+		measure(&b, 1, rates[i], count);
+		print_run((arc) ? "osc -> ring" : "osc -> led", rates[i], count,
+		          &b.run);
+	}
+
+	lo_address_free(b.server);
+	lo_server_free(b.app);
+	sosc_vdev_close(&b.dev);
+	s_free(b.run.samples);
+	s_free(arg_rates);
+
+	return EXIT_SUCCESS;
+
+err:
+	if (b.server)
+		lo_address_free(b.server);
+	if (b.app)
+		lo_server_free(b.app);
+
+	sosc_vdev_close(&b.dev);
+	return EXIT_FAILURE;
+}
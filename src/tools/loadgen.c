@@ -0,0 +1,404 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "virtual_monome.h"
+
+/* throws LED traffic at one or more virtual grids (see
+   virtual_monome.c) at a fixed rate, and reports what got through:
+
+     - datagrams sent, and the rate actually achieved
+     - bytes the servers wrote to the serial port
+     - datagrams the kernel dropped on the servers' sockets
+     - mext method calls the servers accepted
+
+   the messages are encoded up front and sent with plain sendto(), so
+   that the generator costs as little as possible. */
+
+#define DEFAULT_RATE     1000
+#define DEFAULT_DURATION 5
+#define DEFAULT_MIX      "set=8,row=2,map=1,ring=1"
+
+/* how long to give the servers to catch up after we stop sending */
+#define DRAIN_TIME 200000
+
+enum {
+	LED_SET,
+	LED_ROW,
+	LED_LEVEL_MAP,
+	RING_MAP,
+
+	KIND_MAX
+};
+
+static const char *kind_names[KIND_MAX] = {"set", "row", "map", "ring"};
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+} datagram_t;
+
+/* each kind of message comes in several variants, sent in turn, so that
+   consecutive writes actually change something. the server skips LED
+   writes which wouldn't. */
+typedef struct {
+	datagram_t *variants;
+	int count;
+	int next;
+} kind_t;
+
+typedef struct {
+	sosc_vdev_t dev;
+	struct sockaddr_in addr;
+
+	uint64_t sent;
+	uint64_t send_errors;
+
+	long long drops_before;
+	uint64_t bytes_before;
+} grid_t;
+
+/**
+ * messages
+ */
+
+static void encode(datagram_t *d, const char *path, lo_message m)
+{
+	d->data = lo_message_serialise(m, path, NULL, &d->len);
+	lo_message_free(m);
+}
+
+static void build_kinds(kind_t *kinds)
+{
+	lo_message m;
+	int i, j;
+
+	/* 128 LEDs on, then the same 128 off */
+	kinds[LED_SET].count = 256;
+	kinds[LED_SET].variants = s_calloc(256, sizeof(datagram_t));
+
+	for (i = 0; i < 256; i++) {
+		m = lo_message_new();
+		lo_message_add(m, "iii", i % 16, (i / 16) % 8, i < 128);
+		encode(&kinds[LED_SET].variants[i], "/monome/grid/led/set", m);
+	}
+
+	/* every row, in alternating patterns */
+	kinds[LED_ROW].count = 16;
+	kinds[LED_ROW].variants = s_calloc(16, sizeof(datagram_t));
+
+	for (i = 0; i < 16; i++) {
+		m = lo_message_new();
+		lo_message_add(m, "iiii", 0, i % 8, (i < 8) ? 0x55 : 0xAA,
+		               (i < 8) ? 0xAA : 0x55);
+		encode(&kinds[LED_ROW].variants[i], "/monome/grid/led/row", m);
+	}
+
+	/* both quads, in two gradients */
+	kinds[LED_LEVEL_MAP].count = 4;
+	kinds[LED_LEVEL_MAP].variants = s_calloc(4, sizeof(datagram_t));
+
+	for (i = 0; i < 4; i++) {
+		m = lo_message_new();
+		lo_message_add(m, "ii", (i % 2) * 8, 0);
+
+		for (j = 0; j < 64; j++)
+			lo_message_add_int32(m, (j + (i / 2) * 8) % 16);
+
+		encode(&kinds[LED_LEVEL_MAP].variants[i],
+		       "/monome/grid/led/level/map", m);
+	}
+
+	/* every ring, in two gradients */
+	kinds[RING_MAP].count = 8;
+	kinds[RING_MAP].variants = s_calloc(8, sizeof(datagram_t));
+
+	for (i = 0; i < 8; i++) {
+		m = lo_message_new();
+		lo_message_add_int32(m, i % 4);
+
+		for (j = 0; j < 64; j++)
+			lo_message_add_int32(m, (j / 4 + (i / 4) * 8) % 16);
+
+		encode(&kinds[RING_MAP].variants[i], "/monome/ring/map", m);
+	}
+}
+
+/* "set=8,row=2,..." into a weight for each kind */
+static int parse_mix(const char *spec, int *weights)
+{
+	char *copy, *tok, *eq;
+	int i, total = 0;
+
+	memset(weights, 0, KIND_MAX * sizeof(*weights));
+
+	if (!(copy = s_strdup(spec)))
+		return -1;
+
+	for (tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+		if (!(eq = strchr(tok, '=')))
+			goto err;
+
+		*eq = '\0';
+
+		for (i = 0; i < KIND_MAX; i++)
+			if (!strcmp(tok, kind_names[i]))
+				break;
+
+		if (i == KIND_MAX || (weights[i] = atoi(eq + 1)) < 0)
+			goto err;
+
+		total += weights[i];
+	}
+
+	s_free(copy);
+	return (total > 0) ? total : -1;
+
+err:
+	s_free(copy);
+	return -1;
+}
+
+/* the order kinds are sent in, spreading each one out over the cycle
+   rather than sending them in clumps (smooth weighted round-robin) */
+static int *build_schedule(const int *weights, int total)
+{
+	int current[KIND_MAX] = {0}, *schedule;
+	int i, n, best;
+
+	if (!(schedule = s_calloc(total, sizeof(*schedule))))
+		return NULL;
+
+	for (n = 0; n < total; n++) {
+		for (best = -1, i = 0; i < KIND_MAX; i++) {
+			current[i] += weights[i];
+
+			if (weights[i] && (best < 0 || current[i] > current[best]))
+				best = i;
+		}
+
+		current[best] -= total;
+		schedule[n] = best;
+	}
+
+	return schedule;
+}
+
+/**
+ * accounting
+ */
+
+/* datagrams the kernel has dropped on the UDP socket bound to `port`,
+   or -1 if we can't tell (linux only) */
+static long long socket_drops(int port)
+{
+	static const char *tables[] = {"/proc/net/udp", "/proc/net/udp6"};
+	long long drops = -1;
+	char line[512], *last;
+	unsigned int p;
+	FILE *f;
+	int i;
+
+	for (i = 0; i < 2 && drops < 0; i++) {
+		if (!(f = fopen(tables[i], "r")))
+			continue;
+
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, " %*d: %*[0-9A-Fa-f]:%x", &p) != 1 || p != port)
+				continue;
+
+			/* the last column is the drop count */
+			line[strcspn(line, "\n")] = '\0';
+
+			if ((last = strrchr(line, ' ')))
+				drops = strtoll(last + 1, NULL, 10);
+
+			break;
+		}
+
+		fclose(f);
+	}
+
+	return drops;
+}
+
+/**
+ * main
+ */
+
+static void sleep_us(uint64_t us)
+{
+	struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+	nanosleep(&ts, NULL);
+}
+
+static void print_usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-r rate] [-d seconds] [-g grids] [-m mix]\n"
+	        "  -r rate     messages per second, over all grids (default %d)\n"
+	        "  -d seconds  how long to send for (default %d)\n"
+	        "  -g grids    number of virtual grids (default 1)\n"
+	        "  -m mix      relative weights of each message, from set, row,\n"
+	        "              map (level/map) and ring (default %s)\n",
+	        progname, DEFAULT_RATE, DEFAULT_DURATION, DEFAULT_MIX);
+}
+
+int main(int argc, char **argv)
+{
+	int rate = DEFAULT_RATE, duration = DEFAULT_DURATION, ngrids = 1;
+	const char *mix = DEFAULT_MIX;
+	int weights[KIND_MAX], *schedule, total, opt, fd, i, port;
+	uint64_t start, elapsed, due, next, sent = 0, bytes;
+	int drops_unknown = 0;
+	long long drops;
+	kind_t kinds[KIND_MAX];
+	datagram_t *d;
+	kind_t *k;
+	grid_t *grids, *g;
+
+	while ((opt = getopt(argc, argv, "r:d:g:m:")) != -1) {
+		switch (opt) {
+		case 'r': rate = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'g': ngrids = atoi(optarg); break;
+		case 'm': mix = optarg; break;
+
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (rate < 1 || duration < 1 || ngrids < 1
+	    || (total = parse_mix(mix, weights)) < 0) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!(schedule = build_schedule(weights, total))
+	    || !(grids = s_calloc(ngrids, sizeof(*grids))))
+		return EXIT_FAILURE;
+
+	memset(kinds, 0, sizeof(kinds));
+	build_kinds(kinds);
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < ngrids; i++) {
+		g = &grids[i];
+
+		if (sosc_vdev_open(&g->dev, 0, NULL, NULL)) {
+			ngrids = i;
+			goto err;
+		}
+
+		port = sosc_vdev_port(&g->dev);
+
+		g->addr.sin_family = AF_INET;
+		g->addr.sin_port = htons(port);
+		g->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		g->drops_before = socket_drops(port);
+		g->bytes_before = sosc_vdev_bytes_in(&g->dev);
+	}
+
+	start = sosc_monotonic_us();
+
+	for (;;) {
+		elapsed = sosc_monotonic_us() - start;
+		due = (elapsed * rate) / 1000000;
+
+		/* if we've fallen behind, catch up in a burst */
+		for (; sent < due; sent++) {
+			g = &grids[sent % ngrids];
+			k = &kinds[schedule[sent % total]];
+			d = &k->variants[k->next];
+			k->next = (k->next + 1) % k->count;
+
+			if (sendto(fd, d->data, d->len, 0, (struct sockaddr *) &g->addr,
+			           sizeof(g->addr)) < 0)
+				g->send_errors++;
+			else
+				g->sent++;
+		}
+
+		if (elapsed >= duration * 1000000ULL)
+			break;
+
+		/* until the next one is due */
+		if ((next = ((sent + 1) * 1000000ULL) / rate) > elapsed)
+			sleep_us(next - elapsed);
+	}
+
+	sleep_us(DRAIN_TIME);
+
+	printf("%llu datagrams in %.2f s, %.0f/s (target %d/s)\n\n",
+	       (unsigned long long) sent, elapsed / 1e6, sent * 1e6 / elapsed,
+	       rate);
+	printf("  %-6s %6s %10s %10s %10s %10s %12s\n", "grid", "port",
+	       "sent", "accepted", "dropped", "errors", "serial B/s");
+
+	for (i = 0; i < ngrids; i++) {
+		g = &grids[i];
+		port = sosc_vdev_port(&g->dev);
+		drops = socket_drops(port);
+		bytes = sosc_vdev_bytes_in(&g->dev) - g->bytes_before;
+
+		/* stopping the server lets us read its counters safely */
+		sosc_vdev_close(&g->dev);
+
+		if (drops >= 0 && g->drops_before >= 0)
+			drops -= g->drops_before;
+		else
+			drops_unknown = drops = -1;
+
+		printf("  %-6d %6d %10llu %10llu %10lld %10llu %12.0f\n",
+		       i, port, (unsigned long long) g->sent,
+		       (unsigned long long) g->dev.state.stats.mext_handled,
+		       drops, (unsigned long long) g->send_errors,
+		       bytes * 1e6 / elapsed);
+	}
+
+	if (drops_unknown)
+		printf("\n(socket drops are only available on linux, -1 above)\n");
+
+	close(fd);
+	return EXIT_SUCCESS;
+
+err:
+	for (i = 0; i < ngrids; i++)
+		sosc_vdev_close(&grids[i].dev);
+
+	close(fd);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,369 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <monome.h>
+
+#include "serialosc.h"
+#include "virtual_monome.h"
+
+/* the device end of a pty, pretending to be a mext grid or arc. it
+   answers the system queries libmonome makes when it opens a device,
+   and hands everything else the host writes to the tool's callback.
+
+   the host end gets a serialosc server, driven from its own thread the
+   same way a hosted device is (see src/supervisor/hosted.c). */
+
+#define SS_SYSTEM   0x0
+#define SS_LED_GRID 0x1
+#define SS_KEY_GRID 0x2
+#define SS_ENCODER  0x5
+#define SS_LED_RING 0x9
+
+/* the payload length of each command the host can send, by subsystem
+   and command */
+static const uint8_t payload_len[16][16] = {
+	[SS_SYSTEM]   = {[0x2] = 32, [0x4] = 3, [0x6] = 2, [0x8] = 2},
+	[SS_LED_GRID] = {2, 2, 0, 0, 10, 3, 3, 1, 3, 1, 34, 6, 6},
+	[SS_LED_RING] = {3, 2, 33, 4}
+};
+
+static char config_home[] = "/tmp/serialosc-tool.XXXXXX";
+
+static void remove_config_home()
+{
+	rmdir(config_home);
+}
+
+/* keep the servers' config files away from the user's real ones. the
+   serialosc directory under it never exists, so nothing gets saved. */
+static int isolate_config()
+{
+	static int done = 0;
+
+	if (done)
+		return 0;
+
+	if (!mkdtemp(config_home)) {
+		perror("mkdtemp");
+		return -1;
+	}
+
+	setenv("XDG_CONFIG_HOME", config_home, 1);
+	atexit(remove_config_home);
+
+	done = 1;
+	return 0;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int make_raw(int fd)
+{
+	struct termios t;
+
+	if (tcgetattr(fd, &t))
+		return -1;
+
+	t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP
+	               | INLCR | IGNCR | ICRNL | IXON);
+	t.c_oflag &= ~OPOST;
+	t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	t.c_cflag &= ~(CSIZE | PARENB);
+	t.c_cflag |= CS8;
+
+	return tcsetattr(fd, TCSANOW, &t);
+}
+
+/**
+ * device end
+ */
+
+static void reply_system(sosc_vdev_t *v, int cmd)
+{
+	uint8_t buf[33];
+
+	switch (cmd) {
+	case 0x0: /* query: what subsystems, and how many of each */
+		buf[0] = 0x00;
+		buf[1] = (v->arc) ? SS_ENCODER : SS_LED_GRID;
+		buf[2] = (v->arc) ? 4 : 1;
+		write_all(v->master, buf, 3);
+		break;
+
+	case 0x1: /* id */
+		memset(buf, 0, sizeof(buf));
+		buf[0] = 0x01;
+		strncpy((char *) buf + 1, (v->arc) ? "monome arc 4" : "monome 128", 32);
+		write_all(v->master, buf, 33);
+		break;
+
+	case 0x5: /* grid size */
+		buf[0] = 0x03;
+		buf[1] = 16;
+		buf[2] = 8;
+		write_all(v->master, buf, 3);
+		break;
+	}
+}
+
+/* hands each whole message at the front of the buffer to the callback,
+   and returns how many bytes were used up */
+static size_t parse(sosc_vdev_t *v, uint64_t when)
+{
+	size_t off = 0, len;
+	int addr, cmd;
+
+	while (off < v->len) {
+		addr = v->buf[off] >> 4;
+		cmd  = v->buf[off] & 0xF;
+		len  = 1 + payload_len[addr][cmd];
+
+		if (off + len > v->len)
+			break;
+
+		if (addr == SS_SYSTEM)
+			reply_system(v, cmd);
+		else if (v->cb)
+			v->cb(v, v->buf + off, len, when, v->cb_data);
+
+		off += len;
+	}
+
+	return off;
+}
+
+static void *device_run(void *data)
+{
+	sosc_vdev_t *v = data;
+	struct pollfd fds[1];
+	uint64_t now;
+	ssize_t n;
+	size_t used;
+
+	fds[0].fd = v->master;
+	fds[0].events = POLLIN;
+
+	while (v->running) {
+		if (poll(fds, 1, 100) <= 0)
+			continue;
+
+		if ((n = read(v->master, v->buf + v->len,
+		              sizeof(v->buf) - v->len)) <= 0) {
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			break;
+		}
+
+		now = sosc_monotonic_us();
+
+		pthread_mutex_lock(&v->lock);
+		v->bytes_in += n;
+		pthread_mutex_unlock(&v->lock);
+
+		v->len += n;
+		used = parse(v, now);
+
+		memmove(v->buf, v->buf + used, v->len - used);
+		v->len -= used;
+	}
+
+	return NULL;
+}
+
+int sosc_vdev_key(sosc_vdev_t *v, int x, int y, int down)
+{
+	uint8_t msg[3] = {(SS_KEY_GRID << 4) | !!down, x, y};
+	return write_all(v->master, msg, sizeof(msg));
+}
+
+int sosc_vdev_enc(sosc_vdev_t *v, int n, int delta)
+{
+	uint8_t msg[3] = {SS_ENCODER << 4, n, (uint8_t) (int8_t) delta};
+	return write_all(v->master, msg, sizeof(msg));
+}
+
+uint64_t sosc_vdev_bytes_in(sosc_vdev_t *v)
+{
+	uint64_t bytes;
+
+	pthread_mutex_lock(&v->lock);
+	bytes = v->bytes_in;
+	pthread_mutex_unlock(&v->lock);
+
+	return bytes;
+}
+
+/**
+ * host end
+ */
+
+static void *server_run(void *data)
+{
+	sosc_vdev_t *v = data;
+	sosc_state_t *state = &v->state;
+	struct pollfd fds[2];
+	int timeout;
+
+	fds[0].fd = monome_get_fd(state->monome);
+	fds[0].events = POLLIN;
+	fds[1].fd = lo_server_get_socket_fd(state->server);
+	fds[1].events = POLLIN;
+
+	while (v->running) {
+		/* wake up now and then to notice that we've been stopped */
+		timeout = sosc_server_timeout(state);
+		if (timeout < 0 || timeout > 100)
+			timeout = 100;
+
+		if (poll(fds, 2, timeout) < 0)
+			continue;
+
+		sosc_latency_woke(state);
+
+		if (fds[0].revents & POLLIN)
+			sosc_server_drain_monome(state);
+
+		if (fds[1].revents & POLLIN)
+			sosc_server_drain_osc(state);
+
+		sosc_server_run_timers(state);
+	}
+
+	return NULL;
+}
+
+int sosc_vdev_port(sosc_vdev_t *v)
+{
+	return lo_server_get_port(v->state.server);
+}
+
+int sosc_vdev_open(sosc_vdev_t *v, int arc, sosc_vdev_cb_t cb, void *data)
+{
+	const char *name;
+	monome_t *monome;
+
+	memset(v, 0, sizeof(*v));
+	v->arc = arc;
+	v->cb = cb;
+	v->cb_data = data;
+	pthread_mutex_init(&v->lock, NULL);
+
+	if (isolate_config())
+		return -1;
+
+	if ((v->master = posix_openpt(O_RDWR | O_NOCTTY)) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+
+	if (grantpt(v->master) || unlockpt(v->master)
+	    || !(name = ptsname(v->master))) {
+		perror("couldn't set up pty");
+		goto err_pty;
+	}
+
+	strncpy(v->slave, name, sizeof(v->slave) - 1);
+
+	/* holding the slave open ourselves means the master never sees a
+	   hangup, however libmonome opens and closes it. */
+	if ((v->slave_fd = open(v->slave, O_RDWR | O_NOCTTY)) < 0
+	    || make_raw(v->slave_fd)) {
+		perror(v->slave);
+		goto err_pty;
+	}
+
+	v->running = 1;
+
+	if (pthread_create(&v->device_thread, NULL, device_run, v)) {
+		fprintf(stderr, "sosc_vdev_open(): couldn't start device thread\n");
+		goto err_thread;
+	}
+
+	if (!(monome = monome_open(v->slave))) {
+		fprintf(stderr, "sosc_vdev_open(): libmonome couldn't open %s. some "
+		        "versions can only identify serial devices through udev.\n",
+		        v->slave);
+		goto err_monome;
+	}
+
+	v->state.monome = monome;
+	v->state.ipc_fd = -1;
+
+	if (sosc_server_start(&v->state))
+		goto err_server;
+
+	if (pthread_create(&v->server_thread, NULL, server_run, v)) {
+		fprintf(stderr, "sosc_vdev_open(): couldn't start server thread\n");
+		goto err_server_thread;
+	}
+
+	return 0;
+
+err_server_thread:
+	sosc_server_stop(&v->state);
+err_server:
+	monome_close(monome);
+err_monome:
+	v->running = 0;
+	pthread_join(v->device_thread, NULL);
+err_thread:
+	close(v->slave_fd);
+err_pty:
+	close(v->master);
+	return -1;
+}
+
+void sosc_vdev_close(sosc_vdev_t *v)
+{
+	v->running = 0;
+
+	pthread_join(v->server_thread, NULL);
+	sosc_server_stop(&v->state);
+	monome_close(v->state.monome);
+
+	pthread_join(v->device_thread, NULL);
+	close(v->slave_fd);
+	close(v->master);
+}
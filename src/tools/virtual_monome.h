@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2010-2011 William Light <wrl@illest.net>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SOSC_VIRTUAL_MONOME_H
+#define SOSC_VIRTUAL_MONOME_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "serialosc.h"
+
+/* a pty which speaks enough of the mext serial protocol for libmonome to
+   open it, with a serialosc server running on top, for the tools in this
+   directory to measure against. see src/tools/virtual_monome.c */
+
+typedef struct sosc_vdev sosc_vdev_t;
+
+/* called from the device thread for each whole message the host writes,
+   with the time (sosc_monotonic_us()) it was read off the pty. */
+typedef void (*sosc_vdev_cb_t)(sosc_vdev_t *v, const uint8_t *msg, size_t len,
+                               uint64_t when, void *data);
+
+struct sosc_vdev {
+	int master;
+	int slave_fd;
+	char slave[64];
+
+	/* a 4-encoder arc rather than a 128 grid */
+	int arc;
+
+	sosc_vdev_cb_t cb;
+	void *cb_data;
+
+	/* bytes the host has written to the device, under lock */
+	pthread_mutex_t lock;
+	uint64_t bytes_in;
+
+	uint8_t buf[256];
+	size_t len;
+
+	pthread_t device_thread;
+	pthread_t server_thread;
+	volatile int running;
+
+	sosc_state_t state;
+};
+
+int  sosc_vdev_open(sosc_vdev_t *v, int arc, sosc_vdev_cb_t cb, void *data);
+void sosc_vdev_close(sosc_vdev_t *v);
+
+/* device events, as if from the hardware */
+int sosc_vdev_key(sosc_vdev_t *v, int x, int y, int down);
+int sosc_vdev_enc(sosc_vdev_t *v, int n, int delta);
+
+/* the port the device's OSC server listens on */
+int sosc_vdev_port(sosc_vdev_t *v);
+uint64_t sosc_vdev_bytes_in(sosc_vdev_t *v);
+
+#endif /* defined SOSC_VIRTUAL_MONOME_H */